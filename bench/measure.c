@@ -0,0 +1,172 @@
+/*
+ * INCLUDES
+ */
+
+#define	_GNU_SOURCE
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * MACROS
+ */
+
+/* Per process I/O counters of the kernel. Those of a child are added
+ * to the ones of its parent when it is reaped */
+#define	PROC_IO_FILE				"/proc/self/io"
+
+/* Most -l labels of a run */
+#define	MAX_LABELS					16
+
+/* Counters read from PROC_IO_FILE */
+#define	IO_READ_BYTES				0
+#define	IO_WRITE_BYTES				1
+#define	IO_READ_CALLS				2
+#define	IO_WRITE_CALLS				3
+#define	NUM_IO_COUNTERS				4
+
+/*
+ * FUNCTIONS PROTOTYPES
+ */
+void readIoCounters(unsigned long long *counters);
+void printJsonString(FILE *file, char *string);
+void usage();
+
+/*
+ * FUNCTIONS
+ */
+
+/*
+ * measure runs a command and appends a JSON line with its exit status,
+ * wall and CPU time, peak RSS and read/write syscall and byte counts,
+ * taken from wait4() and from the counters the kernel adds to ours when
+ * the command is reaped, so that any tool can be measured the same way.
+ *
+ *   measure -o FILE [-l KEY=VALUE]... [-b BYTES] -- COMMAND [ARG]...
+ *
+ * Labels are written as string fields ahead of the measures; BYTES, the
+ * size of the data the command goes through, gives the throughput.
+ */
+int main(int argc, char *argv[]) {
+	char *resultsName = NULL;
+	char *labels[MAX_LABELS];
+	int numLabels = 0;
+	unsigned long long numBytes = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "o:l:b:")) != -1) {
+		if (opt == 'o')
+			resultsName = optarg;
+		else if (opt == 'l' && numLabels < MAX_LABELS &&
+				strchr(optarg, '=') != NULL)
+			labels[numLabels++] = optarg;
+		else if (opt == 'b')
+			numBytes = strtoull(optarg, NULL, 10);
+		else
+			usage();
+	}
+	if (resultsName == NULL || optind == argc)
+		usage();
+
+	unsigned long long before[NUM_IO_COUNTERS];
+	unsigned long long after[NUM_IO_COUNTERS];
+	readIoCounters(before);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid_t pid = fork();
+	if (pid == -1)
+		err(1, "failed to fork");
+	if (pid == 0) {
+		execvp(argv[optind], argv + optind);
+		err(127, "failed to run %s", argv[optind]);
+	}
+	int status;
+	struct rusage childUsage;
+	if (wait4(pid, &status, 0, &childUsage) == -1)
+		err(1, "failed to wait for %s", argv[optind]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	readIoCounters(after);
+
+	double wallSeconds = (end.tv_sec - start.tv_sec)
+						+ (end.tv_nsec - start.tv_nsec) / 1e9;
+	int exitStatus = WIFEXITED(status) ? WEXITSTATUS(status)
+					: 128 + WTERMSIG(status);
+
+	FILE *results = fopen(resultsName, "a");
+	if (results == NULL)
+		err(1, "failed to open %s", resultsName);
+	fputc('{', results);
+	for (int i = 0; i < numLabels; i++) {
+		char *value = strchr(labels[i], '=');
+		*value++ = '\0';
+		printJsonString(results, labels[i]);
+		fputc(':', results);
+		printJsonString(results, value);
+		fputc(',', results);
+	}
+	fprintf(results, "\"status\":%d,\"bytes\":%llu,\"wallSeconds\":%.6f,"
+		"\"userSeconds\":%.6f,\"systemSeconds\":%.6f,\"mbPerSecond\":%.3f,"
+		"\"peakRssKb\":%ld,\"readBytes\":%llu,\"writeBytes\":%llu,"
+		"\"readCalls\":%llu,\"writeCalls\":%llu}\n",
+		exitStatus, numBytes, wallSeconds,
+		childUsage.ru_utime.tv_sec + childUsage.ru_utime.tv_usec / 1e6,
+		childUsage.ru_stime.tv_sec + childUsage.ru_stime.tv_usec / 1e6,
+		(wallSeconds > 0) ? numBytes / wallSeconds / 1e6 : 0.0,
+		childUsage.ru_maxrss,
+		after[IO_READ_BYTES] - before[IO_READ_BYTES],
+		after[IO_WRITE_BYTES] - before[IO_WRITE_BYTES],
+		after[IO_READ_CALLS] - before[IO_READ_CALLS],
+		after[IO_WRITE_CALLS] - before[IO_WRITE_CALLS]);
+	fclose(results);
+	return (exitStatus);
+}
+
+/*
+ * reads the I/O counters of this process, left at 0 if the kernel does
+ * not provide them.
+ */
+void readIoCounters(unsigned long long *counters) {
+	memset(counters, 0, NUM_IO_COUNTERS * sizeof (unsigned long long));
+	FILE *io = fopen(PROC_IO_FILE, "r");
+	if (io == NULL)
+		return;
+	char line[128];
+	unsigned long long value;
+	while (fgets(line, sizeof (line), io) != NULL) {
+		if (sscanf(line, "rchar: %llu", &value) == 1)
+			counters[IO_READ_BYTES] = value;
+		else if (sscanf(line, "wchar: %llu", &value) == 1)
+			counters[IO_WRITE_BYTES] = value;
+		else if (sscanf(line, "syscr: %llu", &value) == 1)
+			counters[IO_READ_CALLS] = value;
+		else if (sscanf(line, "syscw: %llu", &value) == 1)
+			counters[IO_WRITE_CALLS] = value;
+	}
+	fclose(io);
+}
+
+void printJsonString(FILE *file, char *string) {
+	fputc('"', file);
+	for (; *string != '\0'; string++) {
+		unsigned char c = *string;
+		if (c == '"' || c == '\\')
+			fprintf(file, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(file, "\\u%04x", c);
+		else
+			fputc(c, file);
+	}
+	fputc('"', file);
+}
+
+void usage() {
+	fprintf(stderr, "Usage: measure -o FILE [-l KEY=VALUE]... [-b BYTES]"
+		" -- COMMAND [ARG]...\n");
+	exit(2);
+}
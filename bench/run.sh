@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# Benchmarks mytar against GNU tar over a matrix of synthetic archives.
+#
+#   bench/run.sh [-o RESULTS] [-d WORKDIR] [-r REPEATS] [-j JOBS]
+#       [NAME=SHAPE]...
+#
+# Every SHAPE, a --generate shape COUNT:MIN-MAX:NAMELEN, is written once
+# to WORKDIR. Each archive is then listed (-t), extracted (-x) and has
+# its first, middle and last members extracted (-x NAMES) by mytar and by
+# GNU tar, REPEATS times, and bench/measure appends a JSON line per run
+# to RESULTS. JOBS is passed to mytar -x as -j. MYTAR, TAR and MEASURE
+# name the programs run.
+#
+
+MYTAR=${MYTAR:-./mytar}
+TAR=${TAR:-tar}
+MEASURE=${MEASURE:-bench/measure}
+results=bench-results.jsonl
+workDir=bench-work
+repeats=1
+jobs=
+
+while getopts o:d:r:j: opt; do
+	case $opt in
+	o) results=$OPTARG ;;
+	d) workDir=$OPTARG ;;
+	r) repeats=$OPTARG ;;
+	j) jobs="-j $OPTARG" ;;
+	*) sed -n 's/^#   //p' "$0" >&2; exit 2 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+# a million tiny files, a few huge files and a mix of both
+[ $# -gt 0 ] || set -- tiny=1000000:0-4K:16 huge=4:1G-4G:8 \
+	mixed=100000:0-64M:24
+
+mkdir -p "$workDir" || exit 2
+case $MYTAR in /*) ;; *) MYTAR=$(pwd)/$MYTAR ;; esac
+case $MEASURE in /*) ;; *) MEASURE=$(pwd)/$MEASURE ;; esac
+case $results in /*) ;; *) results=$(pwd)/$results ;; esac
+
+# runs a command of tool in an empty directory of workDir, measured
+run() {
+	tool=$1 op=$2
+	shift 2
+	i=0
+	while [ $i -lt "$repeats" ]; do
+		rm -rf "$workDir/out" && mkdir "$workDir/out" || exit 2
+		(cd "$workDir/out" && "$MEASURE" -o "$results" -l tool="$tool" \
+			-l op="$op" -l shape="$name" -l spec="$spec" -b "$bytes" \
+			-- "$@" > /dev/null) || echo "$tool $op $name failed" >&2
+		i=$((i + 1))
+	done
+	rm -rf "$workDir/out"
+}
+
+for shape in "$@"; do
+	name=${shape%%=*}
+	spec=${shape#*=}
+	archive=$workDir/$name.tar
+	"$MYTAR" --generate "$spec" -f "$archive" || exit 2
+	case $archive in /*) ;; *) archive=$(pwd)/$archive ;; esac
+	bytes=$(wc -c < "$archive")
+
+	count=${spec%%:*}
+	nameLen=${spec##*:}
+	selected=$(for i in 0 $((count / 2)) $((count - 1)); do
+		printf '%0*d\n' "$nameLen" $i
+	done | sort -u)
+
+	run mytar list "$MYTAR" -t -f "$archive"
+	run tar list "$TAR" -t -f "$archive"
+	run mytar extract "$MYTAR" $jobs -x -f "$archive"
+	run tar extract "$TAR" -x -f "$archive"
+	run mytar select "$MYTAR" $jobs -x -f "$archive" $selected
+	run tar select "$TAR" -x -f "$archive" $selected
+	rm -f "$archive"
+done
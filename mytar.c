@@ -2,13 +2,41 @@
  * INCLUDES
  */
 
+#define	_GNU_SOURCE
+
 #include <unistd.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <assert.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <grp.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <dirent.h>
+#include <linux/io_uring.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "mytar.h"
 
 /*
  * MACROS
@@ -23,12 +51,32 @@
 /* Options of tar command */
 #define	OPT_FILENAME				"-f"
 #define	OPT_LIST_FILES				"-t"
+#define	OPT_JOBS					"-j"
+#define	OPT_FILES_FROM				"-T"
+#define	OPT_BUILD_INDEX				"--build-index"
+#define	OPT_STATS					"--stats"
+#define	OPT_ZSTD					"--zstd"
+#define	OPT_IO_URING				"--io-uring"
+#define	OPT_QUEUE_DEPTH				"--queue-depth"
+#define	OPT_GENERATE				"--generate"
+#define	OPT_BENCH					"--bench"
+#define	OPT_EXCLUDE					"--exclude"
+#define	OPT_WILDCARDS				"--wildcards"
+#define	OPT_NO_WILDCARDS			"--no-wildcards"
+#define	OPT_NO_MATCH_SLASH			"--no-wildcards-match-slash"
+#define	OPT_SKIP_UNCHANGED			"--skip-unchanged"
+#define	OPT_VERIFY					"--verify"
+#define	OPT_NULL					"--null"
+#define	OPT_JSON					"--json"
+#define	OPT_ARCHIVES_FROM			"--archives-from"
+#define	OPT_ARCHIVE_JOBS			"--archive-jobs"
+#define	OPT_IO_POLICY				"--io-policy"
 
-/* Block size of blocks of an archive */
-#define	BLOCKSIZE_BYTES				512
+/* Largest member size read from a header, the largest file offset */
+#define	MEMBER_MAX_BYTES			((uint64_t) INT64_MAX)
 
-/* Maximun size of file name */
-#define	SIZE_NAME_MAX				100
+/* Size of the records a created archive is padded to */
+#define	RECORDSIZE_BYTES			(20 * BLOCKSIZE_BYTES)
 
 /* Maximum number of files not found */
 #define	MAX_FILES_NOT_FOUND			100
@@ -39,323 +87,6045 @@
 /* Error codes */
 #define	ERROR_CODE_TWO				2
 
-/* Values for typeflag field */
-/* Regular file */
-#define	REGTYPE						'0'
-/* Regular file */
-#define	AREGTYPE					'\0'
-/* Link */
-#define	LNKTYPE						'1'
-/* Reserved */
-#define	SYMTYPE						'2'
-/* Character special */
-#define	CHRTYPE						'3'
-/* Block special */
-#define	BLKTYPE						'4'
-/* Directory */
-#define	DIRTYPE						'5'
-/* FIFO special */
-#define	FIFOTYPE					'6'
-/* Reserved */
-#define	CONTTYPE					'7'
-/* Extended header referring to the next file in the archive */
-#define	XHDTYPE						'x'
-/* Global extended header */
-#define	XGLTYPE						'g'
-
 /* Value for magic field for a tar file */
 #define	TAR_MAGIC "ustar  \0"
+/* Value for magic and version fields for a POSIX tar file */
+#define	POSIX_MAGIC "ustar\0" "00"
+
+/* Sidecar member index: file name suffix and magic */
+#define	INDEX_SUFFIX				".idx"
+#define	INDEX_MAGIC					"MYTARIX2"
+
+/* Size of the chunks an arena grows by */
+#define	ARENA_CHUNK_BYTES			(1024 * 1024)
+
+/* Alignment of arena allocations */
+#define	ARENA_ALIGNMENT				16
+
+/* Reader backends of an opened archive */
+#define	READER_STDIO				1
+#define	READER_MMAP					2
+#define	READER_STREAM				3
+#define	READER_SEEKABLE				4
+
+/* Archive name standing for the standard input */
+#define	STDIN_ARCHIVE				"-"
+
+/* Magic numbers of compressed archives */
+#define	GZIP_MAGIC					"\x1f\x8b"
+#define	ZSTD_MAGIC					"\x28\xb5\x2f\xfd"
+
+/* Seekable gzip archives: tar data per frame, frames per table member,
+ * magic and size of the footer member */
+#define	SEEKABLE_FRAME_BYTES		(1024 * 1024)
+#define	SEEKABLE_TABLE_ENTRIES		8000
+#define	SEEKABLE_MAGIC				"MYTARSK1"
+#define	SEEKABLE_FOOTER_BYTES		42
+
+/* Header of the empty gzip members holding the frame table and footer */
+#define	GZIP_EXTRA_HEADER			"\x1f\x8b\x08\x04\0\0\0\0\0\xff"
+#define	GZIP_EXTRA_HEADER_BYTES		10
+
+/* Ring of buffers the decompression thread of a stream fills */
+#define	STREAM_BUFFERS				4
+#define	STREAM_BUFFER_BYTES			(1024 * 1024)
+
+/* Formats of the names written by -t, and the size of the buffer they
+ * are written through */
+#define	LIST_TEXT					0
+#define	LIST_NUL					1
+#define	LIST_JSON					2
+#define	LIST_BUFFER_BYTES			(1024 * 1024)
+
+/* Size of the buffer used to copy member data through user space */
+#define	COPY_BUFFER_BYTES			(1024 * 1024)
+
+/* Directory descriptors kept open while extracting */
+#define	DIR_CACHE_MAX_FDS			256
+
+/* Archive creation: reader threads by default, files read ahead of the
+ * writer, largest file read into memory, and size of the write batches */
+#define	CREATE_READERS				4
+#define	CREATE_WINDOW				64
+#define	CREATE_INLINE_BYTES			(1024 * 1024)
+#define	CREATE_BATCH_BYTES			(4 * 1024 * 1024)
+
+/* Synthetic archives: seed of their contents and sizes, size of the
+ * block of contents members are cut from, and their mtime */
+#define	GENERATE_SEED				0x6d7974617262656eULL
+#define	GENERATE_DATA_BYTES			(1024 * 1024)
+#define	GENERATE_MTIME				1000000000
+
+/* Counters of --stats, kept by every thread and added up at the end */
+#define	STAT_HEADERS				0
+#define	STAT_BYTES_READ				1
+#define	STAT_BYTES_WRITTEN			2
+#define	STAT_BYTES_SKIPPED			3
+#define	STAT_FILES_OPENED			4
+#define	STAT_ALLOCATIONS			5
+#define	NUM_STATS					6
+
+/* Phases the wall time of every thread is split into for --stats */
+#define	PHASE_OTHER					0
+#define	PHASE_SCAN					1
+#define	PHASE_MATCH					2
+#define	PHASE_COPY					3
+#define	PHASE_OUTPUT				4
+#define	NUM_PHASES					5
+
+/* Per process I/O counters of the kernel, read for --bench */
+#define	PROC_IO_FILE				"/proc/self/io"
+
+/* States of a file being prepared for a new archive */
+#define	ITEM_PENDING				0
+#define	ITEM_READY					1
+#define	ITEM_NOT_FOUND				2
+#define	ITEM_UNSUPPORTED			3
+#define	ITEM_UNCHANGED				4
+
+/* Name of the pax extended header of a member whose name is too long
+ * for a ustar header */
+#define	PAX_HEADER_NAME				"././@PaxHeader"
+
+/* Archives processed at once when several are given: at most this many
+ * by default, fewer if the online CPUs divided by the -j workers of
+ * each archive are fewer, and at most ARCHIVE_MAX_JOBS with
+ * --archive-jobs */
+#define	ARCHIVE_JOBS				8
+#define	ARCHIVE_MAX_JOBS			256
+
+/* Archives started but not written out yet, per archive processed at
+ * once, so that a slow archive holds back the output of few others */
+#define	ARCHIVE_RUNS_AHEAD			2
+
+/* io_uring extraction: default and largest number of members in flight,
+ * largest member written in a single request, and the requests of a
+ * member, kept in the low bits of their user_data */
+#define	URING_QUEUE_DEPTH			64
+#define	URING_MAX_QUEUE_DEPTH		4096
+#define	URING_MAX_WRITE_BYTES		(1024 * 1024)
+#define	URING_OPEN					0
+#define	URING_WRITE					1
+#define	URING_CLOSE					2
+
+/* Tokens of a compiled wildcard pattern: a byte, ?, [...], *, ** and
+ * ** followed by a slash, matching any directories, the end of a
+ * pattern, and the end of an exclude pattern, which matches the
+ * directory of a subtree too */
+#define	GLOB_LITERAL				0
+#define	GLOB_ANY					1
+#define	GLOB_CLASS					2
+#define	GLOB_STAR					3
+#define	GLOB_GLOBSTAR				4
+#define	GLOB_GLOBSTAR_DIR			5
+#define	GLOB_ACCEPT					6
+#define	GLOB_SUBTREE				7
+
+/* Number of cached states of the wildcard automaton it is rebuilt at */
+#define	GLOB_MAX_STATES				4096
+
+/* What a member name matched, see matchName() */
+#define	MATCH_INCLUDE				1
+#define	MATCH_EXCLUDE				2
+
+/* What --skip-unchanged compares an existing file with a member by */
+#define	UNCHANGED_OFF				0
+#define	UNCHANGED_STAT				1
+#define	UNCHANGED_CONTENTS			2
+
+/* Outcomes of extracting a member; EXTRACT_PENDING is a member still to
+ * be extracted as usual */
+#define	EXTRACT_DONE				0
+#define	EXTRACT_TRUNCATED			1
+#define	EXTRACT_UNCHANGED			2
+#define	EXTRACT_PENDING				3
+
+/* Instruction sets of the header validation kernels */
+#define	SIMD_UNKNOWN				0
+#define	SIMD_SCALAR					1
+#define	SIMD_SSE2					2
+#define	SIMD_AVX2					3
+
+/* CRC32C instruction of SSE4.2, detected apart from the levels above */
+#define	SIMD_SSE42					4
+
+/* Reflected CRC32C (Castagnoli) polynomial */
+#define	CRC32C_POLY					0x82f63b78
+
+/* Largest piece of member data hashed by a single --verify thread */
+#define	VERIFY_PIECE_BYTES			(4 * 1024 * 1024)
+
+/* Blocks checksummed at a time when looking for the next valid header */
+#define	HEADER_BATCH				64
+
+/* Span of the archive read ahead of and dropped behind the read
+ * position, and of an extracted file written back at a time */
+#define	IO_WINDOW_BYTES				(8 * 1024 * 1024)
+
+/* Smallest member written with O_DIRECT, and the alignment and size of
+ * the buffer it is written from */
+#define	DIRECT_MIN_BYTES			(1024 * 1024)
+#define	DIRECT_ALIGN_BYTES			4096
+#define	DIRECT_BUFFER_BYTES			(4 * 1024 * 1024)
+
+/* Ways of copying member data out of a mapped archive, fastest first */
+#define	COPY_FILE_RANGE				1
+#define	COPY_SENDFILE				2
+#define	COPY_WRITE					3
 
 /*
  * GLOBAL VARIABLES
  */
-typedef struct header {
-    union {
-		struct {
-			char name[100];
-			char mode[8];
-			char uid[8];
-			char gid[8];
-			char size[12];
-			char mtime[12];
-			char chksum[8];
-			char typeflag;
-			char linkname[100];
-			char magic[6];
-			char version[2];
-			char uname[32];
-			char gname[32];
-			char devmajor[8];
-			char devminor[8];
-			char prefix[155];
-		};
-		char block[BLOCKSIZE_BYTES];
-	};
-	struct header * next;
-} header_t;
-
-typedef struct file {
+int simdLevel = SIMD_UNKNOWN;
+int crc32cLevel = SIMD_UNKNOWN;
+uint32_t crc32cTable[256];
+uint32_t crc32cPowers[32];
+pthread_once_t crc32cOnce = PTHREAD_ONCE_INIT;
+/* whether extraction already said it drops the leading slashes */
+bool isSlashRemovalNoticed = false;
+#ifndef MYTAR_LIBRARY
+/* --bench run of the tool, written out at exit */
+struct bench *benchmark = NULL;
+#endif
+
+/*
+ * owner names of the last file a -c reader thread prepared, looked up
+ * again only when the owner changes, as the files of a tree mostly
+ * share theirs.
+ */
+__thread uid_t cachedUid = (uid_t) -1;
+__thread gid_t cachedGid = (gid_t) -1;
+__thread char cachedUname[32];
+__thread char cachedGname[32];
+
+/*
+ * --stats counters. Every thread counts into its own threadStats with
+ * plain increments, so they stay on, and adds them with
+ * mergeThreadStats() when it ends to threadTotals, the stats_t of the
+ * run it works for, which the threads it starts inherit. Phases are only
+ * timed if those totals are enabled, as that costs a clock read per
+ * switch. Threads of programs using the library have no totals.
+ */
+__thread uint64_t threadStats[NUM_STATS];
+__thread uint64_t threadPhaseNanos[NUM_PHASES];
+__thread int threadPhase = PHASE_OTHER;
+__thread uint64_t threadPhaseStart = 0;
+__thread struct stats *threadTotals = NULL;
+
+
+/*
+ * Bump allocator owning the headers and names of one archive pass. Its
+ * memory is handed out from chunks of ARENA_CHUNK_BYTES (larger requests
+ * get a chunk of their own) and released all at once.
+ */
+typedef struct arenaChunk {
+	struct arenaChunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+} arenaChunk_t;
+
+typedef struct arena {
+	arenaChunk_t *chunks;
+	size_t numChunks;
+	size_t numAllocations;
+	size_t used;
+	size_t reserved;
+	size_t peakReserved;
+} arena_t;
+
+/*
+ * A table of members kept in insertion order, with an open addressing
+ * hash on the name (slot value 0 is empty, otherwise member number + 1).
+ * Names are copied into the arena of the table; headers are not owned by
+ * the table. A name maps to its first member.
+ */
+typedef struct member {
+	char *name;
+	header_t *header;
+} member_t;
+
+typedef struct memberTable {
+	member_t *members;
+	size_t numMembers;
+	size_t capacity;
+	size_t *slots;
+	size_t numSlots;
+	arena_t *arena;
+} memberTable_t;
+
+/*
+ * Wildcard patterns selecting members, compiled together so that a name
+ * is matched in a single pass whatever the number of patterns. tokens
+ * holds the patterns one after the other, each ending in GLOB_ACCEPT,
+ * and a position in it is a state of the nondeterministic automaton.
+ * The deterministic states, sets of positions, are built as names need
+ * them and kept along with their transitions, so once the first names
+ * have been matched a name costs one table lookup per byte. As in GNU
+ * tar, wildcards match '/' too unless isSlashMatched is cleared, when *,
+ * ? and [...] match within a path component and only ** across them.
+ * A ** followed by '/' matches any number of whole directories, none
+ * included. Exclude patterns also match after any '/' of a name, and
+ * under the directories they match. Names are matched without their
+ * trailing slashes.
+ */
+typedef struct globToken {
+	int type;
+	unsigned char c;
+	int pattern;
+	uint64_t set[4];
+} globToken_t;
+
+typedef struct globState {
+	int *positions;
+	size_t numPositions;
+	uint64_t hash;
+	int next[256];
+	int matched;
+	int *accepted;
+	size_t numAccepted;
+} globState_t;
+
+typedef struct matcher {
+	globToken_t *tokens;
+	size_t numTokens;
+	size_t tokensCapacity;
+	char **patterns;
+	bool *isExclude;
+	bool *isMatched;
+	int numPatterns;
+	int numIncludes;
+	int numExcludes;
+	int patternsCapacity;
+	globState_t **states;
+	size_t numStates;
+	size_t statesCapacity;
+	bool *isInSet;
+	bool isSlashMatched;
+} matcher_t;
+
+/*
+ * --stats totals of the threads of a run.
+ */
+typedef struct stats {
+	bool isEnabled;
+	uint64_t counts[NUM_STATS];
+	uint64_t phaseNanos[NUM_PHASES];
+	int numThreads;
+	pthread_mutex_t lock;
+} stats_t;
+
+/*
+ * Decompressed input of an archive, or the plain input of an archive
+ * that cannot seek such as a pipe. A thread reads the file and
+ * decompresses it into a ring of STREAM_BUFFERS buffers, so that reads
+ * and decompression overlap the parsing and the writes of the consumer.
+ * With COMPRESS_AUTO the thread detects the compression from the first
+ * bytes it reads. error is the TAR_ERR_ code that ended the stream
+ * early, or TAR_OK; the consumer takes it once the stream ends.
+ * The producer fills buffer producerIndex while fewer than
+ * STREAM_BUFFERS are filled; the consumer reads buffer consumerIndex
+ * from consumerOffset and hands it back once exhausted.
+ */
+typedef struct stream {
+	int fd;
+	int compression;
+	int ioPolicy;
+	int error;
+	stats_t *totals;
+	pthread_t thread;
+	char *buffers[STREAM_BUFFERS];
+	size_t lengths[STREAM_BUFFERS];
+	int numFilled;
+	int producerIndex;
+	int consumerIndex;
+	size_t consumerOffset;
+	size_t inputOffset;
+	size_t droppedOffset;
+	bool isEnded;
+	bool isStopping;
+	pthread_mutex_t lock;
+	pthread_cond_t filled;
+	pthread_cond_t drained;
+} stream_t;
+
+/*
+ * A seekable gzip archive is a series of gzip members, the frames, each
+ * holding at most SEEKABLE_FRAME_BYTES of the tar data compressed on its
+ * own, followed by the frame table: empty gzip members whose extra field
+ * (subfield "MT") holds the compressed and uncompressed sizes of up to
+ * SEEKABLE_TABLE_ENTRIES frames as pairs of little endian 32-bit values,
+ * and a footer member of SEEKABLE_FOOTER_BYTES whose extra field
+ * (subfield "MF") holds the number of frames, the size of the table
+ * members and SEEKABLE_MAGIC. Plain gzip tools decompress it as usual.
+ *
+ * When reading, the file is mapped and only the frame holding the
+ * current position is decompressed; offsets has the uncompressed offset
+ * of every frame plus the total size, compressedOffsets the same in the
+ * file.
+ */
+typedef struct seekable {
+	char *map;
+	size_t mapSize;
+	size_t numFrames;
+	uint64_t *offsets;
+	uint64_t *compressedOffsets;
+	char *frame;
+	size_t frameNumber;
+	void *decoder;
+} seekable_t;
+
+/*
+ * Output of a new archive. Uncompressed archives are written straight to
+ * fd; seekable gzip archives are gathered into frames of
+ * SEEKABLE_FRAME_BYTES, and the sizes of the compressed frames are kept
+ * for the frame table written by closeWriter().
+ */
+typedef struct writer {
+	int fd;
+	int compression;
+	char *frame;
+	size_t frameUsed;
+	char *output;
+	size_t outputSize;
+	uint32_t *frameSizes;
+	size_t numFrames;
+	size_t capacity;
+	void *encoder;
+} writer_t;
+
+/*
+ * Attributes of the next member set by its pax extended header, which
+ * override those of its ustar header. Strings point into the records.
+ */
+typedef struct extended {
+	char *path;
+	char *sparseName;
+	uint64_t size;
+	bool isSizeSet;
+	bool isSparse;
+	int sparseMajor;
+	uint64_t sparseOffset;
+} extended_t;
+
+/*
+ * An opened archive. With READER_MMAP the whole file is mapped and
+ * headers are returned as views into the mapping; READER_STDIO is the
+ * fallback for files that cannot be mapped, READER_STREAM reads
+ * compressed archives through a stream_t and READER_SEEKABLE reads
+ * seekable gzip archives through a seekable_t, whose size is the size of
+ * the uncompressed tar data. Streams cannot seek, so skipping past their
+ * end sets isTruncated instead. numSkippedHeaders counts the headers
+ * found corrupt by readHeader(). copyMethod is the fastest way of copying
+ * member data that has worked so far on a mapped archive.
+ * readMemberHeader() sets memberName and memberSize, the number of bytes
+ * of member data left in the archive, from the headers of the current
+ * member, numHeaderBlocks to the number of blocks they took, and sparse
+ * to its map if it is a sparse file. error is the TAR_ERR_ code of a
+ * read that failed, or TAR_OK. ioPolicy is the IO_ page cache policy of
+ * the archive and of the files extracted from it.
+ */
+struct archive {
+	int reader;
+	int fd;
+	int ioPolicy;
+	FILE *file;
+	stream_t *stream;
+	seekable_t *seekable;
+	bool isTruncated;
+	int error;
+	size_t numSkippedHeaders;
+	char *map;
+	size_t size;
+	size_t offset;
+	size_t droppedOffset;
+	bool isDroppingBehind;
+	int copyMethod;
+	char *copyBuffer;
+	char *memberName;
+	size_t memberSize;
+	size_t numHeaderBlocks;
+	sparseMap_t *sparse;
+	sparseMap_t sparseMap;
+	char *extendedData;
+	size_t extendedCapacity;
+	char longName[SIZE_PREFIX_MAX + SIZE_NAME_MAX + 2];
+	header_t header;
+	char buffer[BLOCKSIZE_BYTES];
+};
+
+/*
+ * Pool of threads extracting members of a mapped archive in parallel.
+ * The thread scanning the headers queues one job per member and the
+ * workers take them in order from the shared queue, each copying its
+ * member with positioned reads, so a large member only holds up the
+ * worker copying it. Names of the jobs live in the pool arena, which
+ * only the scanning thread allocates from. A job creates baseName in
+ * the directory dir, or name from the current directory without one.
+ */
+typedef struct extractJob {
+	char *name;
+	char *baseName;
+	struct jobDir *dir;
+	size_t offset;
+	size_t bytesToWrite;
+	int64_t mtime;
+} extractJob_t;
+
+/*
+ * Descriptor of a directory members are queued into, duplicated from
+ * the one the dirCache_t held as cacheFd during its generation, as the
+ * cache may close its own while jobs still need it. The members of a
+ * directory queued one after the other share it; numRefs counts those
+ * jobs and the pool while it is the last directory queued into, under
+ * the lock of the pool, and it is closed with the last of them.
+ */
+typedef struct jobDir {
+	int fd;
+	int cacheFd;
+	size_t generation;
+	int numRefs;
+} jobDir_t;
+
+/*
+ * Directories of the members being extracted, keyed by path. Each one is
+ * created once, and members are opened relative to the descriptor of
+ * their parent with openat() so that the kernel does not walk the whole
+ * path again. fds holds the descriptor of every path of the table, -1
+ * once closed. When DIR_CACHE_MAX_FDS are open they are all closed and
+ * reopened as members need them, which in an archive stored directory
+ * by directory is seldom, and generation counts those times. path is a
+ * copy of the directory being opened.
+ */
+typedef struct dirCache {
+	memberTable_t *paths;
+	int *fds;
+	size_t capacity;
+	int numOpen;
+	size_t generation;
+	char *path;
+	size_t pathSize;
+} dirCache_t;
+
+/*
+ * Data of an archive checked with --verify. The members of a mapped
+ * archive are cut into pieces of at most VERIFY_PIECE_BYTES while the
+ * headers are scanned; every thread then takes pieces in turn, so that a
+ * large member is hashed by all of them, and the CRC32C of a member is
+ * put together from those of its pieces. Members of other archives are
+ * hashed as they are read and have no pieces.
+ */
+typedef struct verifyPiece {
+	size_t offset;
+	size_t len;
+	uint32_t crc;
+} verifyPiece_t;
+
+typedef struct verifyMember {
+	char *name;
+	uint64_t size;
+	size_t firstPiece;
+	size_t numPieces;
+	uint32_t crc;
+} verifyMember_t;
+
+typedef struct verifyPool {
+	archive_t *archive;
+	stats_t *totals;
+	verifyPiece_t *pieces;
+	size_t numPieces;
+	size_t nextPiece;
+} verifyPool_t;
+
+/*
+ * Shape of a synthetic archive: numMembers members whose sizes are spread
+ * log-uniformly between minSize and maxSize, with names of nameLen
+ * characters.
+ */
+typedef struct generateSpec {
+	size_t numMembers;
+	uint64_t minSize;
+	uint64_t maxSize;
+	int nameLen;
+} generateSpec_t;
+
+/*
+ * An archive of the many given to a single invocation, processed by a
+ * child process whose standard output and error go to memory files
+ * until its turn to be written comes.
+ */
+typedef struct archiveRun {
+	pid_t pid;
+	int outFd;
+	int errFd;
+	bool isDone;
+} archiveRun_t;
+
+/*
+ * A run measured for --bench, with the number of members selected on the
+ * command line. The results are appended to fileName as a JSON line when
+ * the process exits.
+ */
+typedef struct bench {
+	char *fileName;
+	char *mode;
+	char *archiveName;
+	int numSelected;
+	struct timespec start;
+} bench_t;
+
+/*
+ * Pipeline creating an archive. A walker thread lists the files given
+ * and the trees of the directories among them into fileNames, with
+ * names from the pipeline arena, and sets isListed once done. Reader
+ * threads take the listed files in order, stat and open them, build
+ * their header and read small files into memory, at most CREATE_WINDOW
+ * files ahead of the writer. The calling thread writes the prepared
+ * files in order through a large batch buffer; large files are copied
+ * from their descriptor instead. extended holds the pax header written
+ * before a member whose name does not fit in its own. With archived,
+ * the latest mtime of every member name in archivedMtimes, files that
+ * are not more recent are left out (-u).
+ */
+typedef struct createItem {
+	int status;
+	int error;
 	char *name;
-	struct file *next;
-} file_t;
+	int fd;
+	char *data;
+	size_t size;
+	size_t bytesRead;
+	char *extended;
+	size_t extendedSize;
+	header_t header;
+} createItem_t;
+
+typedef struct createPipeline {
+	char **args;
+	int numArgs;
+	char **fileNames;
+	size_t numFiles;
+	size_t capacity;
+	bool isListed;
+	int walkStatus;
+	arena_t *arena;
+	stats_t *totals;
+	memberTable_t *archived;
+	int64_t *archivedMtimes;
+	createItem_t items[CREATE_WINDOW];
+	size_t nextToRead;
+	size_t nextToWrite;
+	pthread_mutex_t lock;
+	pthread_cond_t itemReady;
+	pthread_cond_t windowOpen;
+} createPipeline_t;
+
+/*
+ * io_uring instance extracting members of a mapped archive without
+ * worker threads. Every member is a chain of linked requests: an openat
+ * into a registered file slot, a write from the mapping and a close of
+ * the slot, so that a batch of members costs one io_uring_enter call.
+ * A member posts a single completion, from its close or from the request
+ * that failed, and its slot is free again once it arrives. names holds
+ * the member of each slot for error reporting, and dirs the directory
+ * it is created in.
+ */
+typedef struct uring {
+	int fd;
+	char *ring;
+	size_t ringSize;
+	struct io_uring_sqe *sqes;
+	size_t sqesSize;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_cqe *cqes;
+	unsigned numToSubmit;
+	int *freeSlots;
+	int numFreeSlots;
+	int queueDepth;
+	char **names;
+	jobDir_t **dirs;
+} uring_t;
+
+typedef struct extractPool {
+	archive_t *archive;
+	uring_t *uring;
+	arena_t *arena;
+	stats_t *totals;
+	pthread_t *threads;
+	int numThreads;
+	extractJob_t *jobs;
+	size_t numJobs;
+	size_t capacity;
+	jobDir_t *lastDir;
+	size_t nextJob;
+	size_t numJobsDone;
+	bool isClosed;
+	pthread_mutex_t lock;
+	pthread_cond_t jobQueued;
+	pthread_cond_t jobDone;
+} extractPool_t;
+
+/*
+ * On-disk layout of the sidecar index of an archive: an indexHeader_t,
+ * numEntries indexEntry_t records in archive order, an open addressing
+ * table of numSlots entry numbers keyed on the member name (slot value 0
+ * is empty, otherwise entry number + 1), and namesSize bytes of
+ * nul-terminated member names, each at the nameOffset of its entry, so
+ * that prefix and PAX path names are kept whole. A name maps to its
+ * first occurrence in the archive.
+ */
+typedef struct indexHeader {
+	char magic[8];
+	uint64_t archiveSize;
+	int64_t archiveMtimeSec;
+	int64_t archiveMtimeNsec;
+	uint64_t numEntries;
+	uint64_t numSlots;
+	int64_t posZeroBlock;
+	int64_t isLoneZeroBlock;
+	uint64_t namesSize;
+} indexHeader_t;
+
+typedef struct indexEntry {
+	uint64_t offset;
+	uint64_t size;
+	int64_t mtime;
+	uint64_t nameOffset;
+	uint64_t nameLength;
+	char typeflag;
+} indexEntry_t;
+
+typedef struct index {
+	char *map;
+	size_t mapSize;
+	indexHeader_t *header;
+	indexEntry_t *entries;
+	uint64_t *slots;
+	char *names;
+} index_t;
 
 /*
  * FUNCTIONS PROTOTYPES
  */
-header_t *createHeader();
-file_t *createFile(char *fileName);
-header_t *addHeader(header_t *list, header_t *new);
-file_t *addFile(file_t *listFiles, file_t *new);
-void printNameHeaders(header_t *list);
-void printNameFiles(file_t *listFiles, int filesNotFoundCount);
-void printNameFilesExtracted(file_t *list);
-void printNameFilesTruncated(file_t *list);
+arena_t *createArena();
+void *arenaAlloc(arena_t *arena, size_t len);
+void releaseArena(arena_t *arena);
+void printArenaStats(arena_t *arena);
+uint64_t nowNanos();
+void enterPhase(int phase);
+void initStats(stats_t *totals, bool isEnabled);
+void mergeThreadStats();
+void printStats(stats_t *totals, uint64_t wallNanos);
+header_t *createHeader(arena_t *arena);
+memberTable_t *createMemberTable(arena_t *arena);
+member_t *addMember(memberTable_t *table, char *name, header_t *header);
+member_t *findMember(memberTable_t *table, char *name);
+void insertMemberSlot(memberTable_t *table, size_t memberNumber);
+void rehashMemberTable(memberTable_t *table, size_t numSlots);
+void freeMemberTable(memberTable_t *table);
+void printListEntry(FILE *file, int listFormat, char *name,
+		header_t *header, uint64_t size);
+void printNameFiles(memberTable_t *files, int filesNotFoundCount,
+		int listFormat);
+void printNameFilesExtracted(memberTable_t *files);
+void printNameFilesTruncated(memberTable_t *files);
+int getSimdLevel();
+void sumBlocks(char *blocks, size_t numBlocks, unsigned int *sums);
+void sumBlocksScalar(char *blocks, size_t numBlocks, unsigned int *sums);
+#if defined(__x86_64__)
+void sumBlocksSse2(char *blocks, size_t numBlocks, unsigned int *sums);
+void sumBlocksAvx2(char *blocks, size_t numBlocks, unsigned int *sums);
+bool isZeroBlockSse2(char *block);
+bool isZeroBlockAvx2(char *block);
+#endif
 bool isZeroBlock(header_t *header);
-size_t countBytesToSkip(header_t *header);
-int findFile(char *fileName, header_t *list);
-int findFileExtracted(char *fileName, file_t *list);
-void sortFileList(file_t **ptrFilesFound);
-int checkTruncatedFile(FILE *tarArchive);
+int getCrc32cLevel();
+void initCrc32c();
+void fillCrc32cTables();
+uint32_t crc32c(uint32_t crc, char *data, size_t len);
+uint32_t crc32cScalar(uint32_t crc, unsigned char *data, size_t len);
+#if defined(__x86_64__)
+uint32_t crc32cSse42(uint32_t crc, unsigned char *data, size_t len);
+#endif
+uint32_t multModP(uint32_t a, uint32_t b);
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+bool isValidChecksum(header_t *header, unsigned int sum);
+size_t findHeaderBlock(char *blocks, size_t numBlocks);
+size_t getContentSize(header_t *header);
+void putNumeric(char *field, size_t len, uint64_t value);
+size_t roundUpToBlock(size_t contentSize);
+void sortFileList(memberTable_t *files);
+int compareMembers(const void *a, const void *b);
+void addName(char ***names, int *numNames, int *capacity, char *name);
+char *readNameList(char *fileName, char ***names, int *numNames,
+		int *capacity);
+matcher_t *createMatcher();
+void freeMatcher(matcher_t *matcher);
+bool isGlobPattern(char *name);
+void addGlobPattern(matcher_t *matcher, char *pattern, bool isExclude);
+globToken_t *addGlobToken(matcher_t *matcher, int type, unsigned char c);
+char *parseGlobClass(char *cursor, globToken_t *token);
+void addGlobPosition(matcher_t *matcher, size_t position);
+int findGlobState(matcher_t *matcher);
+int globTransition(matcher_t *matcher, int state, unsigned char c);
+void resetGlobStates(matcher_t *matcher);
+int matchName(matcher_t *matcher, char *name);
+bool isSelectedMember(memberTable_t *requested, matcher_t *matcher,
+		char *name);
+int addUnmatchedPatterns(matcher_t *matcher, memberTable_t *filesNotFound);
+void exitNotFound(memberTable_t *filesNotFound);
+int checkTruncatedFile(archive_t *archive);
 bool isTarFile(char *magicField);
-void freeList(void *list, int dataType);
+bool isSupportedMember(header_t *header);
 void *xmalloc(size_t len);
-void extractEmptyFile(char *fileName);
+int createFile(char *fileName);
+dirCache_t *createDirCache(arena_t *arena);
+void freeDirCache(dirCache_t *cache);
+void closeDirectories(dirCache_t *cache);
+int openDirectory(dirCache_t *cache, char *path);
+int openParentDirectory(dirCache_t *cache, char *fileName, char **baseName);
+int makeDirectory(dirCache_t *cache, char *dirName);
+int createMemberFile(dirCache_t *dirs, char *fileName);
+void setFileMtime(int fd, int64_t mtime);
+void extractEmptyFile(dirCache_t *dirs, char *fileName, int64_t mtime);
+char *extractedName(char *fileName);
+int extractFile(iterator_t *iterator, char *fileName, int *posZeroBlock,
+		extractPool_t *pool, dirCache_t *dirs, int skipUnchanged);
+int updateExistingFile(iterator_t *iterator, dirCache_t *dirs,
+		char *fileName, int64_t mtime, int skipUnchanged);
+size_t copyMemberData(archive_t *archive, int fdOut, size_t contentSize,
+		size_t bytesToRead);
+bool copyRange(archive_t *archive, size_t offset, int fdOut, size_t len,
+		int *copyMethod);
+int copyRangeDirect(archive_t *archive, size_t offset, int fdOut,
+		size_t len);
+void adviseWritten(archive_t *archive, int fd, size_t start, size_t end);
+void adviseClosing(archive_t *archive, int fd);
+void adviseArchive(archive_t *archive);
+extractPool_t *createExtractPool(archive_t *archive, int numThreads);
+void queueExtractJob(extractPool_t *pool, dirCache_t *dirs, int dirFd,
+		char *fileName, char *baseName, size_t offset, size_t bytesToWrite,
+		int64_t mtime);
+jobDir_t *holdJobDir(extractPool_t *pool, dirCache_t *dirs, int dirFd);
+void releaseJobDir(jobDir_t *dir);
+void waitExtractPool(extractPool_t *pool);
+void finishExtractPool(extractPool_t *pool);
+void *extractWorker(void *arg);
+extractPool_t *createUringPool(archive_t *archive, int queueDepth);
+uring_t *openUring(int queueDepth);
+void closeUring(uring_t *uring);
+struct io_uring_sqe *getUringSqe(uring_t *uring);
+void queueUringJob(uring_t *uring, jobDir_t *dir, char *fileName,
+		char *baseName, char *data, size_t len);
+void reapUring(uring_t *uring, bool isWaiting);
+void waitUring(uring_t *uring);
+unsigned int headerChecksum(header_t *header);
+void prepareItem(createItem_t *item, char *fileName, memberTable_t *archived,
+		int64_t *archivedMtimes);
+void addPaxName(createItem_t *item, char *name, int64_t mtime);
+void *createReader(void *arg);
+void *createWalker(void *arg);
+void walkDirectory(createPipeline_t *pipeline, char *dirName);
+void listFile(createPipeline_t *pipeline, char *fileName);
+void copyFd(int fdIn, writer_t *writer, size_t len, char *buffer,
+		size_t bufferSize);
+int createArchive(char *tarArchiveName, char **fileNames, int numFiles,
+		int numReaders, bool verbose, int compression, off_t appendOffset,
+		memberTable_t *archived, int64_t *archivedMtimes);
+int appendArchive(char *tarArchiveName, char **fileNames, int numFiles,
+		int numReaders, bool verbose, bool isUpdate);
+bool initHeader(header_t *header, char *name, unsigned int mode,
+		uint64_t size, uint64_t mtime);
+bool setHeaderName(header_t *header, char *name);
+void setChecksum(header_t *header);
+size_t countTrailerBytes(size_t archiveSize);
+void parseGenerateSpec(char *arg, generateSpec_t *spec);
+uint64_t parseByteCount(char *arg, char **end);
+uint64_t nextRandom(uint64_t *state);
+int generateArchive(char *tarArchiveName, generateSpec_t *spec,
+		int compression);
+writer_t *createWriter(int fd, int compression);
+void writeArchive(writer_t *writer, char *buffer, size_t len);
+void flushFrame(writer_t *writer);
+void writeExtraMember(int fd, char *subfield, char *data, size_t len);
+void closeWriter(writer_t *writer);
+void putLe32(char *buffer, uint32_t value);
+uint32_t getLe32(char *buffer);
+bool writeAll(int fd, char *buffer, size_t len);
+void writeOrExit(int fd, char *buffer, size_t len);
+int detectCompression(int fd);
+int detectMagic(char *magic, size_t len);
+bool checkCompression(int compression);
+stream_t *openStream(int fd, int compression, int ioPolicy);
+void closeStream(stream_t *stream);
+void *streamProducer(void *arg);
+void dropStreamInput(stream_t *stream, size_t bytesRead);
+size_t fillStreamBuffer(stream_t *stream, char *buffer, void *decoder,
+		char *input, size_t *inputStart, size_t *inputEnd, bool *isEnded);
+size_t peekStream(stream_t *stream, char **data);
+void consumeStream(stream_t *stream, size_t len);
+size_t readStream(stream_t *stream, char *buffer, size_t len);
+seekable_t *openSeekable(int fd, size_t fileSize);
+void closeSeekable(seekable_t *seekable);
+bool decodeFrame(seekable_t *seekable, size_t frameNumber);
+size_t peekSeekable(archive_t *archive, char **data);
+size_t readBlock(archive_t *archive, char **block);
+size_t readArchive(archive_t *archive, char *buffer, size_t len);
+header_t *readHeader(archive_t *archive);
+header_t *readMemberHeader(archive_t *archive);
+char *readExtendedData(archive_t *archive, size_t len);
+void parseExtendedHeader(archive_t *archive, char *records, size_t len,
+		extended_t *extended);
+bool readGnuSparseMap(archive_t *archive, header_t *header);
+bool readSparseMapData(archive_t *archive);
+void addSparseRegions(sparseMap_t *map, char *entries, size_t numEntries);
+void addSparseRegion(sparseMap_t *map, uint64_t offset, uint64_t len);
+bool isValidSparseMap(archive_t *archive);
+void exitUnexpectedEof();
+void exitCannotOpen(char *fileName);
+void exitArchiveError(iterator_t *iterator, int status);
+bool skipToNextHeader(archive_t *archive, char **block);
+header_t *keepHeader(archive_t *archive, header_t *header, arena_t *arena);
+void skipBytes(archive_t *archive, size_t bytesToSkip);
+void seekArchive(archive_t *archive, size_t offset);
+uint64_t hashName(char *name);
+char *indexFileName(char *tarArchiveName);
+void buildIndex(char *tarArchiveName, int compression, int ioPolicy);
+index_t *openIndex(char *tarArchiveName);
+bool isIndexValid(char *map, size_t mapSize);
+indexEntry_t *findIndexEntry(index_t *index, char *fileName);
+char *indexEntryName(index_t *index, indexEntry_t *entry);
+void closeIndex(index_t *index);
+int compareIndexEntries(const void *a, const void *b);
+int verifyArchive(char *tarArchiveName, int compression, int ioPolicy,
+		char *manifestName, int numThreads);
+void hashPieces(verifyPool_t *pool, int numThreads);
+void hashNextPieces(verifyPool_t *pool);
+void *verifyWorker(void *arg);
+#ifndef MYTAR_LIBRARY
+void startBench(char *fileName, char *mode, char *archiveName,
+		int numSelected);
+void writeBenchResults();
+#endif
+void printJsonString(FILE *file, char *string);
+char *runArchives(char **archiveNames, int numArchives, int numWorkers,
+		bool isGrouped);
+void writeArchiveOutput(archiveRun_t *run, char *archiveName,
+		bool isGrouped, bool *isFirst);
 
 /*
  * FUNCTIONS
  */
 
-header_t *createHeader() {
-	header_t *new = xmalloc(sizeof (header_t));
-	new->next = NULL;
+arena_t *createArena() {
+	arena_t *new = xmalloc(sizeof (arena_t));
+	new->chunks = NULL;
+	new->numChunks = 0;
+	new->numAllocations = 0;
+	new->used = 0;
+	new->reserved = 0;
+	new->peakReserved = 0;
+	return (new);
+}
+
+void *arenaAlloc(arena_t *arena, size_t len) {
+	threadStats[STAT_ALLOCATIONS]++;
+	assert(len != 0);
+	len = (len + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1);
+
+	arenaChunk_t *chunk = arena->chunks;
+	if (chunk == NULL || chunk->size - chunk->used < len) {
+		size_t size = (len > ARENA_CHUNK_BYTES) ? len : ARENA_CHUNK_BYTES;
+		chunk = xmalloc(sizeof (arenaChunk_t) + size);
+		chunk->size = size;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->numChunks++;
+		arena->reserved += size;
+		if (arena->reserved > arena->peakReserved)
+			arena->peakReserved = arena->reserved;
+	}
+
+	void *buf = chunk->data + chunk->used;
+	chunk->used += len;
+	arena->used += len;
+	arena->numAllocations++;
+	return (buf);
+}
+
+/*
+ * frees every chunk of the arena. The arena itself stays usable and
+ * keeps its peak for reporting.
+ */
+void releaseArena(arena_t *arena) {
+	arenaChunk_t *current = arena->chunks;
+	while (current != NULL) {
+		arenaChunk_t *next = current->next;
+		free(current);
+		current = next;
+	}
+	arena->chunks = NULL;
+	arena->numChunks = 0;
+	arena->used = 0;
+	arena->reserved = 0;
+}
+
+void printArenaStats(arena_t *arena) {
+	fprintf(stderr, MSG_PREFFIX " arena: %zu allocations, %zu bytes used,"
+			" peak %zu bytes in %zu chunks\n", arena->numAllocations,
+			arena->used, arena->peakReserved, arena->numChunks);
+}
+
+uint64_t nowNanos() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return ((uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+/*
+ * charges the time since the last switch to the current phase of the
+ * thread and moves it to phase.
+ */
+void enterPhase(int phase) {
+	if (threadTotals == NULL || !threadTotals->isEnabled ||
+		phase == threadPhase)
+		return;
+	uint64_t now = nowNanos();
+	if (threadPhaseStart != 0)
+		threadPhaseNanos[threadPhase] += now - threadPhaseStart;
+	threadPhase = phase;
+	threadPhaseStart = now;
+}
+
+/*
+ * makes totals, counting phases if isEnabled, the totals of the calling
+ * thread and of the threads it starts.
+ */
+void initStats(stats_t *totals, bool isEnabled) {
+	memset(totals, 0, sizeof (stats_t));
+	totals->isEnabled = isEnabled;
+	pthread_mutex_init(&totals->lock, NULL);
+	threadTotals = totals;
+}
+
+/*
+ * adds the counters of the calling thread to its totals, once it is done.
+ */
+void mergeThreadStats() {
+	enterPhase(PHASE_OTHER);
+	stats_t *totals = threadTotals;
+	if (totals != NULL) {
+		pthread_mutex_lock(&totals->lock);
+		for (int i = 0; i < NUM_STATS; i++)
+			totals->counts[i] += threadStats[i];
+		for (int i = 0; i < NUM_PHASES; i++)
+			totals->phaseNanos[i] += threadPhaseNanos[i];
+		totals->numThreads++;
+		pthread_mutex_unlock(&totals->lock);
+	}
+	memset(threadStats, 0, sizeof (threadStats));
+	memset(threadPhaseNanos, 0, sizeof (threadPhaseNanos));
+}
+
+/*
+ * prints the totals of every thread. Phases add up the time of all the
+ * threads, so with workers they exceed the wall time.
+ */
+void printStats(stats_t *totals, uint64_t wallNanos) {
+	uint64_t *counts = totals->counts;
+	uint64_t *phaseNanos = totals->phaseNanos;
+	fprintf(stderr, MSG_PREFFIX " headers: %llu parsed, %llu files opened,"
+			" %llu allocations\n",
+			(unsigned long long) counts[STAT_HEADERS],
+			(unsigned long long) counts[STAT_FILES_OPENED],
+			(unsigned long long) counts[STAT_ALLOCATIONS]);
+	fprintf(stderr, MSG_PREFFIX " bytes: %llu read, %llu written, %llu"
+			" skipped\n", (unsigned long long) counts[STAT_BYTES_READ],
+			(unsigned long long) counts[STAT_BYTES_WRITTEN],
+			(unsigned long long) counts[STAT_BYTES_SKIPPED]);
+	fprintf(stderr, MSG_PREFFIX " time: scan %.6f s, match %.6f s, copy"
+			" %.6f s, output %.6f s, other %.6f s in %d threads; wall %.6f"
+			" s\n", phaseNanos[PHASE_SCAN] / 1e9,
+			phaseNanos[PHASE_MATCH] / 1e9,
+			phaseNanos[PHASE_COPY] / 1e9,
+			phaseNanos[PHASE_OUTPUT] / 1e9,
+			phaseNanos[PHASE_OTHER] / 1e9, totals->numThreads,
+			wallNanos / 1e9);
+}
+
+header_t *createHeader(arena_t *arena) {
+	header_t *new = arenaAlloc(arena, sizeof (header_t));
 	return (new);
 }
 
-file_t *createFile(char *fileName) {
-	file_t *new = xmalloc(sizeof (file_t));
-	char *name = xmalloc(strlen(fileName) + 1);
-	new->name = name;
-	strcpy(new->name, fileName);
-	new->next = NULL;
+memberTable_t *createMemberTable(arena_t *arena) {
+	memberTable_t *new = xmalloc(sizeof (memberTable_t));
+	new->members = NULL;
+	new->numMembers = 0;
+	new->capacity = 0;
+	new->slots = NULL;
+	new->numSlots = 0;
+	new->arena = arena;
 	return (new);
 }
 
-header_t *addHeader(header_t *list, header_t *new) {
-	if (list == NULL)
-		list = new;
-	else {
-		header_t *aux = list;
-		while (aux->next != NULL) {
-			aux = aux -> next;
-		}
-		aux->next = new;
+/*
+ * appends a member to the table in O(1) amortized time. The returned
+ * pointer is valid until the next call.
+ */
+member_t *addMember(memberTable_t *table, char *name, header_t *header) {
+	enterPhase(PHASE_MATCH);
+	if (table->numMembers == table->capacity) {
+		table->capacity = (table->capacity == 0) ? 64 : table->capacity * 2;
+		table->members = realloc(table->members,
+							table->capacity * sizeof (member_t));
+		if (table->members == NULL)
+			err(1, "failed to allocate %zu members", table->capacity);
+	}
+
+	member_t *new = &table->members[table->numMembers++];
+	new->name = arenaAlloc(table->arena, strlen(name) + 1);
+	strcpy(new->name, name);
+	new->header = header;
+
+	if (2 * table->numMembers > table->numSlots)
+		rehashMemberTable(table, 2 * table->capacity);
+	else
+		insertMemberSlot(table, table->numMembers - 1);
+	return (new);
+}
+
+member_t *findMember(memberTable_t *table, char *name) {
+	enterPhase(PHASE_MATCH);
+	if (table->numSlots == 0)
+		return (NULL);
+
+	size_t mask = table->numSlots - 1;
+	size_t slot = hashName(name) & mask;
+	while (table->slots[slot] != 0) {
+		member_t *member = &table->members[table->slots[slot] - 1];
+		if (strcmp(member->name, name) == 0)
+			return (member);
+		slot = (slot + 1) & mask;
 	}
-	return (list);
+	return (NULL);
 }
 
-file_t *addFile(file_t *listFiles, file_t *new) {
-	if (listFiles == NULL)
-		listFiles = new;
-	else {
-		file_t *aux = listFiles;
-		while (aux->next != NULL) {
-			aux = aux->next;
-		}
-		aux->next = new;
+void insertMemberSlot(memberTable_t *table, size_t memberNumber) {
+	size_t mask = table->numSlots - 1;
+	char *name = table->members[memberNumber].name;
+	size_t slot = hashName(name) & mask;
+	while (table->slots[slot] != 0) {
+		if (strcmp(table->members[table->slots[slot] - 1].name, name) == 0)
+			return;
+		slot = (slot + 1) & mask;
 	}
-	return (listFiles);
+	table->slots[slot] = memberNumber + 1;
+}
+
+/*
+ * rebuilds the hash of a table with numSlots slots, which must be a
+ * power of two.
+ */
+void rehashMemberTable(memberTable_t *table, size_t numSlots) {
+	free(table->slots);
+	table->slots = calloc(numSlots, sizeof (size_t));
+	if (table->slots == NULL)
+		err(1, "failed to allocate %zu slots", numSlots);
+	table->numSlots = numSlots;
+	for (size_t i = 0; i < table->numMembers; i++)
+		insertMemberSlot(table, i);
+}
+
+void freeMemberTable(memberTable_t *table) {
+	free(table->members);
+	free(table->slots);
+	free(table);
 }
 
-void printNameHeaders(header_t *list) {
-	header_t *aux = list;
-	while (aux != NULL) {
-		printf("%s\n", aux->name);
-		aux = aux->next;
+/*
+ * writes the name of a listed member in listFormat: a line, a string
+ * ended by a NUL, or a JSON line also holding the size of its data as
+ * stored, its mtime and its type.
+ */
+void printListEntry(FILE *file, int listFormat, char *name,
+		header_t *header, uint64_t size) {
+	enterPhase(PHASE_OUTPUT);
+	if (listFormat != LIST_JSON) {
+		fputs(name, file);
+		fputc((listFormat == LIST_NUL) ? '\0' : '\n', file);
+		return;
 	}
+
+	char *type = "other";
+	if (header->typeflag == REGTYPE || header->typeflag == AREGTYPE)
+		type = "file";
+	else if (header->typeflag == DIRTYPE)
+		type = "directory";
+	else if (header->typeflag == GNUTYPE_SPARSE)
+		type = "sparse";
+	fputs("{\"name\":", file);
+	printJsonString(file, name);
+	fprintf(file, ",\"size\":%llu,\"mtime\":%llu,\"type\":\"%s\"}\n",
+		(unsigned long long) size,
+		(unsigned long long) parseNumeric(header->mtime,
+			sizeof (header->mtime)), type);
 }
 
 /*
- * this method prints the names of the files stored in a linked list.
+ * this method prints the names of the files stored in a member table.
  * If filesNotFoundCount is greater than zero, the names are printed
  * in the standard error stream. Otherwise, they are printed in the
- * standard output stream.
+ * standard output stream. JSON lines need the headers of the files.
  */
-void printNameFiles(file_t *listFiles, int filesNotFoundCount) {
-    file_t *aux = listFiles;
-	while (aux != NULL) {
-		if (filesNotFoundCount > 0)
-			fprintf(stderr, "%s\n", aux->name);
-		else
-			printf("%s\n", aux->name);
-		aux = aux->next;
+void printNameFiles(memberTable_t *files, int filesNotFoundCount,
+		int listFormat) {
+	enterPhase(PHASE_OUTPUT);
+	for (size_t i = 0; i < files->numMembers; i++) {
+		member_t *file = &files->members[i];
+		printListEntry((filesNotFoundCount > 0) ? stderr : stdout,
+			listFormat, file->name, file->header,
+			(file->header != NULL) ? getContentSize(file->header) : 0);
 	}
 }
 
-void printNameFilesExtracted(file_t *list) {
-	file_t *aux = list;
-	while (aux != NULL) {
-		printf("%s\n", aux->name);
-		aux = aux->next;
+void printNameFilesExtracted(memberTable_t *files) {
+	enterPhase(PHASE_OUTPUT);
+	for (size_t i = 0; i < files->numMembers; i++)
+		printf("%s\n", files->members[i].name);
+}
+
+void printNameFilesTruncated(memberTable_t *files) {
+	enterPhase(PHASE_OUTPUT);
+	for (size_t i = 0; i < files->numMembers; i++)
+		fprintf(stderr, "%s\n", files->members[i].name);
+}
+
+/*
+ * returns the instruction set the header validation kernels use, detected
+ * on the first call.
+ */
+int getSimdLevel() {
+	int level = __atomic_load_n(&simdLevel, __ATOMIC_RELAXED);
+	if (level != SIMD_UNKNOWN)
+		return (level);
+	level = SIMD_SCALAR;
+#if defined(__x86_64__)
+	level = SIMD_SSE2;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		level = SIMD_AVX2;
+#endif
+	__atomic_store_n(&simdLevel, level, __ATOMIC_RELAXED);
+	return (level);
+}
+
+/*
+ * stores in sums the sum of the bytes of each of numBlocks consecutive
+ * blocks.
+ */
+void sumBlocks(char *blocks, size_t numBlocks, unsigned int *sums) {
+#if defined(__x86_64__)
+	if (getSimdLevel() == SIMD_AVX2) {
+		sumBlocksAvx2(blocks, numBlocks, sums);
+		return;
 	}
+	sumBlocksSse2(blocks, numBlocks, sums);
+#else
+	sumBlocksScalar(blocks, numBlocks, sums);
+#endif
 }
 
-void printNameFilesTruncated(file_t *list) {
-	file_t *aux = list;
-	while (aux != NULL) {
-		fprintf(stderr, "%s\n", aux->name);
-		aux = aux->next;
+void sumBlocksScalar(char *blocks, size_t numBlocks, unsigned int *sums) {
+	for (size_t i = 0; i < numBlocks; i++) {
+		unsigned char *block = (unsigned char *) blocks + i * BLOCKSIZE_BYTES;
+		unsigned int sum = 0;
+		for (int j = 0; j < BLOCKSIZE_BYTES; j++)
+			sum += block[j];
+		sums[i] = sum;
 	}
 }
 
-bool isZeroBlock(header_t *header) {
-	header_t allZeroHeader;
-	memset(&allZeroHeader, 0, BLOCKSIZE_BYTES);
-	if (memcmp(&allZeroHeader, header, BLOCKSIZE_BYTES) == 0) {
-		return (true);
+#if defined(__x86_64__)
+/*
+ * psadbw against zero adds up each group of 8 bytes into a 64-bit lane;
+ * the lanes of a block are added at the end.
+ */
+void sumBlocksSse2(char *blocks, size_t numBlocks, unsigned int *sums) {
+	__m128i zero = _mm_setzero_si128();
+	for (size_t i = 0; i < numBlocks; i++) {
+		__m128i *block = (__m128i *) (blocks + i * BLOCKSIZE_BYTES);
+		__m128i acc = zero;
+		for (int j = 0; j < BLOCKSIZE_BYTES / 16; j++)
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128(block + j),
+								zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi64(acc, acc));
+		sums[i] = _mm_cvtsi128_si32(acc);
 	}
-	return (false);
 }
 
-size_t countBytesToSkip(header_t *header) {
-	size_t contentSize = strtol(header->size, NULL, OCTAL_BASE);
-	size_t bytesToSkip = 0;
-	if (contentSize > 0) {
-		if (contentSize > BLOCKSIZE_BYTES) {
-			bytesToSkip = (contentSize/BLOCKSIZE_BYTES)
-							* BLOCKSIZE_BYTES;
-			if ((contentSize % BLOCKSIZE_BYTES) != 0)
-				bytesToSkip = ((contentSize/BLOCKSIZE_BYTES)
-								* BLOCKSIZE_BYTES) + BLOCKSIZE_BYTES;
-		} else if (contentSize <= BLOCKSIZE_BYTES)
-			bytesToSkip = BLOCKSIZE_BYTES;
+__attribute__((target("avx2")))
+void sumBlocksAvx2(char *blocks, size_t numBlocks, unsigned int *sums) {
+	__m256i zero = _mm256_setzero_si256();
+	for (size_t i = 0; i < numBlocks; i++) {
+		__m256i *block = (__m256i *) (blocks + i * BLOCKSIZE_BYTES);
+		__m256i acc = zero;
+		for (int j = 0; j < BLOCKSIZE_BYTES / 32; j++)
+			acc = _mm256_add_epi64(acc,
+					_mm256_sad_epu8(_mm256_loadu_si256(block + j), zero));
+		__m128i half = _mm_add_epi64(_mm256_castsi256_si128(acc),
+						_mm256_extracti128_si256(acc, 1));
+		half = _mm_add_epi64(half, _mm_unpackhi_epi64(half, half));
+		sums[i] = _mm_cvtsi128_si32(half);
 	}
-	return (bytesToSkip);
 }
 
-int findFile(char *fileName, header_t *list) {
-	header_t *aux = list;
-	while (aux != NULL) {
-		if (strcmp(fileName, aux->name) == 0)
-			return (1);
-		aux = aux->next;
+/*
+ * ors the 16-byte words of a block together and tests the result.
+ */
+bool isZeroBlockSse2(char *block) {
+	__m128i acc = _mm_setzero_si128();
+	for (int i = 0; i < BLOCKSIZE_BYTES / 16; i++)
+		acc = _mm_or_si128(acc, _mm_loadu_si128((__m128i *) block + i));
+	return (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128()))
+			== 0xffff);
+}
+
+__attribute__((target("avx2")))
+bool isZeroBlockAvx2(char *block) {
+	__m256i acc = _mm256_setzero_si256();
+	for (int i = 0; i < BLOCKSIZE_BYTES / 32; i++)
+		acc = _mm256_or_si256(acc, _mm256_loadu_si256((__m256i *) block + i));
+	return (_mm256_testz_si256(acc, acc));
+}
+#endif
+
+/*
+ * returns SIMD_SSE42 if the CPU has the crc32 instruction, detected on
+ * the first call, and SIMD_SCALAR otherwise.
+ */
+int getCrc32cLevel() {
+	int level = __atomic_load_n(&crc32cLevel, __ATOMIC_RELAXED);
+	if (level != SIMD_UNKNOWN)
+		return (level);
+	level = SIMD_SCALAR;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2"))
+		level = SIMD_SSE42;
+#endif
+	__atomic_store_n(&crc32cLevel, level, __ATOMIC_RELAXED);
+	return (level);
+}
+
+/*
+ * fills the tables of the CRC32C functions once for the whole process.
+ */
+void initCrc32c() {
+	pthread_once(&crc32cOnce, fillCrc32cTables);
+}
+
+/*
+ * fills the byte table of the scalar CRC32C and the powers x^(2^n) mod P
+ * crc32cCombine() shifts by.
+ */
+void fillCrc32cTables() {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t crc = i;
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 1) ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+		crc32cTable[i] = crc;
 	}
-	return (0);
+	uint32_t power = 1U << 30;
+	for (int i = 0; i < 32; i++) {
+		crc32cPowers[i] = power;
+		power = multModP(power, power);
+	}
+	getCrc32cLevel();
+}
+
+/*
+ * returns the CRC32C of crc, the one of the bytes before, followed by
+ * len bytes of data; 0 is the CRC32C of no bytes.
+ */
+uint32_t crc32c(uint32_t crc, char *data, size_t len) {
+	crc = ~crc;
+#if defined(__x86_64__)
+	if (getCrc32cLevel() == SIMD_SSE42)
+		return (~crc32cSse42(crc, (unsigned char *) data, len));
+#endif
+	return (~crc32cScalar(crc, (unsigned char *) data, len));
+}
+
+uint32_t crc32cScalar(uint32_t crc, unsigned char *data, size_t len) {
+	for (size_t i = 0; i < len; i++)
+		crc = crc32cTable[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	return (crc);
 }
 
-int findFileExtracted(char *fileName, file_t *list) {
-	file_t *aux = list;
-	while (aux != NULL) {
-		if (strcmp(fileName, aux->name) == 0)
-			return (1);
-		aux = aux->next;
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32cSse42(uint32_t crc, unsigned char *data, size_t len) {
+	uint64_t crc64 = crc;
+	for (; len >= 8; data += 8, len -= 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
 	}
-	return (0);
+	crc = crc64;
+	for (; len > 0; data++, len--)
+		crc = _mm_crc32_u8(crc, *data);
+	return (crc);
+}
+#endif
+
+/*
+ * product of two polynomials modulo the CRC32C polynomial, in the bit
+ * order of the CRC.
+ */
+uint32_t multModP(uint32_t a, uint32_t b) {
+	uint32_t product = 0;
+	for (uint32_t bit = 1U << 31; bit != 0; bit >>= 1) {
+		if (a & bit)
+			product ^= b;
+		b = (b & 1) ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return (product);
+}
+
+/*
+ * returns the CRC32C of two pieces of data one after the other, from the
+ * CRC32C of each and the length of the second, as zlib does for CRC32.
+ */
+uint32_t crc32cCombine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+	/* x^(8 * len2) mod P, from the powers x^(2^n) of its bits */
+	uint32_t shift = 1U << 31;
+	for (int n = 3; len2 != 0; len2 >>= 1, n++) {
+		if (len2 & 1)
+			shift = multModP(crc32cPowers[n & 31], shift);
+	}
+	return (multModP(shift, crc1) ^ crc2);
+}
+
+/*
+ * sum of the bytes of a header, with the chksum field taken as spaces.
+ */
+unsigned int headerChecksum(header_t *header) {
+	unsigned int sum;
+	sumBlocks(header->block, 1, &sum);
+	for (size_t i = 0; i < sizeof (header->chksum); i++)
+		sum += ' ' - (unsigned char) header->chksum[i];
+	return (sum);
+}
+
+/*
+ * returns true if the chksum field of header matches its contents. sum
+ * is the sum of its bytes; like GNU tar, sums of signed bytes written by
+ * old tars are accepted too.
+ */
+bool isValidChecksum(header_t *header, unsigned int sum) {
+	char *field = header->chksum;
+	size_t i = 0;
+	while (i < sizeof (header->chksum) && field[i] == ' ')
+		i++;
+	if (i == sizeof (header->chksum) || field[i] < '0' || field[i] > '7')
+		return (false);
+	unsigned int stored = 0;
+	for (; i < sizeof (header->chksum) && field[i] >= '0' && field[i] <= '7';
+		i++)
+		stored = stored * OCTAL_BASE + (field[i] - '0');
+
+	for (size_t j = 0; j < sizeof (header->chksum); j++)
+		sum += ' ' - (unsigned char) field[j];
+	if (stored == sum)
+		return (true);
+
+	int signedSum = 0;
+	for (int j = 0; j < BLOCKSIZE_BYTES; j++)
+		signedSum += (signed char) header->block[j];
+	for (size_t j = 0; j < sizeof (header->chksum); j++)
+		signedSum += ' ' - (signed char) field[j];
+	return ((int) stored == signedSum);
+}
+
+/*
+ * returns the number of the first of numBlocks consecutive blocks that
+ * is a zero block or a header with a valid checksum, or numBlocks if
+ * there is none. Blocks are checked HEADER_BATCH at a time.
+ */
+size_t findHeaderBlock(char *blocks, size_t numBlocks) {
+	unsigned int sums[HEADER_BATCH];
+	for (size_t i = 0; i < numBlocks; i += HEADER_BATCH) {
+		size_t batch = numBlocks - i;
+		if (batch > HEADER_BATCH)
+			batch = HEADER_BATCH;
+		sumBlocks(blocks + i * BLOCKSIZE_BYTES, batch, sums);
+		for (size_t j = 0; j < batch; j++) {
+			header_t *header = (header_t *) (blocks + (i + j) * BLOCKSIZE_BYTES);
+			if (sums[j] == 0 || isValidChecksum(header, sums[j]))
+				return (i + j);
+		}
+	}
+	return (numBlocks);
 }
 
-void sortFileList(file_t **ptrFilesFound) {
-	if (*ptrFilesFound == NULL || (*ptrFilesFound)->next == NULL)
+bool isZeroBlock(header_t *header) {
+#if defined(__x86_64__)
+	if (getSimdLevel() == SIMD_AVX2)
+		return (isZeroBlockAvx2(header->block));
+	return (isZeroBlockSse2(header->block));
+#else
+	uint64_t acc = 0;
+	for (int i = 0; i < BLOCKSIZE_BYTES; i += sizeof (uint64_t)) {
+		uint64_t word;
+		memcpy(&word, header->block + i, sizeof (word));
+		acc |= word;
+	}
+	return (acc == 0);
+#endif
+}
+
+size_t getContentSize(header_t *header) {
+	return (parseNumeric(header->size, sizeof (header->size)));
+}
+
+/*
+ * parses a numeric header field: octal digits, or a GNU base-256 number
+ * if the high bit of the first byte is set, as written for sizes of
+ * 8 GiB and more. Negative base-256 numbers, whose next bit is the sign,
+ * are taken as 0, and those above MEMBER_MAX_BYTES as UINT64_MAX.
+ */
+uint64_t parseNumeric(char *field, size_t len) {
+	unsigned char *bytes = (unsigned char *) field;
+	uint64_t value = 0;
+	if (bytes[0] & 0x80) {
+		if (bytes[0] & 0x40)
+			return (0);
+		value = bytes[0] & 0x3f;
+		for (size_t i = 1; i < len; i++) {
+			if (value > MEMBER_MAX_BYTES >> 8)
+				return (UINT64_MAX);
+			value = value << 8 | bytes[i];
+		}
+		return (value);
+	}
+
+	size_t i = 0;
+	while (i < len && field[i] == ' ')
+		i++;
+	for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+		value = value * OCTAL_BASE + (field[i] - '0');
+	return (value);
+}
+
+/*
+ * writes value into a numeric header field of len bytes, in octal if it
+ * fits and in GNU base-256 otherwise.
+ */
+void putNumeric(char *field, size_t len, uint64_t value) {
+	if (value >> (3 * (len - 1)) == 0) {
+		snprintf(field, len, "%0*llo", (int) (len - 1),
+			(unsigned long long) value);
+		return;
+	}
+	for (size_t i = len - 1; i > 0; i--) {
+		field[i] = value & 0xff;
+		value >>= 8;
+	}
+	field[0] = (char) 0x80;
+}
+
+size_t roundUpToBlock(size_t contentSize) {
+	size_t bytesToSkip = 0;
+	if (contentSize > 0) {
+		if (contentSize > BLOCKSIZE_BYTES) {
+			bytesToSkip = (contentSize/BLOCKSIZE_BYTES)
+							* BLOCKSIZE_BYTES;
+			if ((contentSize % BLOCKSIZE_BYTES) != 0)
+				bytesToSkip = ((contentSize/BLOCKSIZE_BYTES)
+								* BLOCKSIZE_BYTES) + BLOCKSIZE_BYTES;
+		} else if (contentSize <= BLOCKSIZE_BYTES)
+			bytesToSkip = BLOCKSIZE_BYTES;
+	}
+	return (bytesToSkip);
+}
+
+/*
+ * sorts the members of a table by name and rebuilds its hash.
+ */
+void sortFileList(memberTable_t *files) {
+	enterPhase(PHASE_MATCH);
+	if (files->numMembers < 2)
+		return;
+
+	qsort(files->members, files->numMembers, sizeof (member_t),
+		compareMembers);
+	rehashMemberTable(files, files->numSlots);
+}
+
+int compareMembers(const void *a, const void *b) {
+	return (strcmp(((member_t *) a)->name, ((member_t *) b)->name));
+}
+
+/*
+ * appends name to an array of names, doubling its capacity as needed.
+ */
+void addName(char ***names, int *numNames, int *capacity, char *name) {
+	if (*numNames == *capacity) {
+		*capacity = (*capacity == 0) ? 64 : *capacity * 2;
+		*names = realloc(*names, *capacity * sizeof (char *));
+		if (*names == NULL)
+			err(1, "failed to allocate %d names", *capacity);
+	}
+	(*names)[(*numNames)++] = name;
+}
+
+/*
+ * appends the names listed in fileName, or in the standard input for
+ * "-", to *names. Names are one per line, or separated by null bytes if
+ * the list has any; empty ones are skipped. They point into the returned
+ * buffer, which must outlive them. Returns NULL, with errno set, if the
+ * list cannot be read.
+ */
+char *readNameList(char *fileName, char ***names, int *numNames,
+		int *capacity) {
+	int fd = STDIN_FILENO;
+	if (strcmp(fileName, STDIN_ARCHIVE) != 0)
+		fd = open(fileName, O_RDONLY);
+	if (fd == -1)
+		return (NULL);
+
+	size_t bufferSize = COPY_BUFFER_BYTES;
+	char *buffer = xmalloc(bufferSize + 1);
+	size_t len = 0;
+	while (1) {
+		if (len == bufferSize) {
+			bufferSize *= 2;
+			buffer = realloc(buffer, bufferSize + 1);
+			if (buffer == NULL)
+				err(1, "failed to allocate %zu bytes", bufferSize + 1);
+		}
+		ssize_t bytesRead = read(fd, buffer + len, bufferSize - len);
+		if (bytesRead == -1 && errno == EINTR)
+			continue;
+		if (bytesRead == -1) {
+			int readErrno = errno;
+			if (fd != STDIN_FILENO)
+				close(fd);
+			free(buffer);
+			errno = readErrno;
+			return (NULL);
+		}
+		if (bytesRead == 0)
+			break;
+		len += bytesRead;
+	}
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	char separator = (memchr(buffer, '\0', len) != NULL) ? '\0' : '\n';
+	buffer[len] = separator;
+	char *name = buffer;
+	for (char *end = buffer; end <= buffer + len; end++) {
+		if (*end != separator)
+			continue;
+		*end = '\0';
+		if (end > name)
+			addName(names, numNames, capacity, name);
+		name = end + 1;
+	}
+	return (buffer);
+}
+
+matcher_t *createMatcher() {
+	matcher_t *new = xmalloc(sizeof (matcher_t));
+	memset(new, 0, sizeof (matcher_t));
+	new->isSlashMatched = true;
+	return (new);
+}
+
+void freeMatcher(matcher_t *matcher) {
+	resetGlobStates(matcher);
+	free(matcher->states);
+	free(matcher->tokens);
+	free(matcher->patterns);
+	free(matcher->isExclude);
+	free(matcher->isMatched);
+	free(matcher->isInSet);
+	free(matcher);
+}
+
+/*
+ * returns true if name holds a wildcard or a character escaped by a
+ * backslash.
+ */
+bool isGlobPattern(char *name) {
+	return (strpbrk(name, "*?[\\") != NULL);
+}
+
+/*
+ * compiles pattern into the automaton of the matcher. The states built
+ * so far are dropped.
+ */
+void addGlobPattern(matcher_t *matcher, char *pattern, bool isExclude) {
+	resetGlobStates(matcher);
+	if (matcher->numPatterns == matcher->patternsCapacity) {
+		int capacity = (matcher->patternsCapacity == 0) ? 16
+					: 2 * matcher->patternsCapacity;
+		matcher->patterns = realloc(matcher->patterns,
+								capacity * sizeof (char *));
+		matcher->isExclude = realloc(matcher->isExclude,
+								capacity * sizeof (bool));
+		matcher->isMatched = realloc(matcher->isMatched,
+								capacity * sizeof (bool));
+		if (matcher->patterns == NULL || matcher->isExclude == NULL ||
+			matcher->isMatched == NULL)
+			err(1, "failed to allocate %d patterns", capacity);
+		matcher->patternsCapacity = capacity;
+	}
+	matcher->patterns[matcher->numPatterns] = pattern;
+	matcher->isExclude[matcher->numPatterns] = isExclude;
+	matcher->isMatched[matcher->numPatterns] = false;
+	if (isExclude) {
+		matcher->numExcludes++;
+		addGlobToken(matcher, GLOB_GLOBSTAR_DIR, '\0');
+	} else
+		matcher->numIncludes++;
+
+	for (char *cursor = pattern; *cursor != '\0'; cursor++) {
+		if (cursor[0] == '*' && cursor[1] == '*') {
+			while (cursor[1] == '*')
+				cursor++;
+			if (cursor[1] == '/') {
+				addGlobToken(matcher, GLOB_GLOBSTAR_DIR, '\0');
+				cursor++;
+			} else
+				addGlobToken(matcher, GLOB_GLOBSTAR, '\0');
+		} else if (*cursor == '*')
+			addGlobToken(matcher, GLOB_STAR, '\0');
+		else if (*cursor == '?')
+			addGlobToken(matcher, GLOB_ANY, '\0');
+		else if (*cursor == '[') {
+			globToken_t *token = addGlobToken(matcher, GLOB_CLASS, '\0');
+			char *end = parseGlobClass(cursor + 1, token);
+			if (end != NULL)
+				cursor = end;
+			else {
+				token->type = GLOB_LITERAL;
+				token->c = '[';
+			}
+		} else {
+			if (*cursor == '\\' && cursor[1] != '\0')
+				cursor++;
+			addGlobToken(matcher, GLOB_LITERAL, *cursor);
+		}
+	}
+	if (isExclude) {
+		addGlobToken(matcher, GLOB_SUBTREE, '\0');
+		addGlobToken(matcher, GLOB_GLOBSTAR, '\0');
+	}
+	addGlobToken(matcher, GLOB_ACCEPT, '\0');
+	matcher->numPatterns++;
+}
+
+globToken_t *addGlobToken(matcher_t *matcher, int type, unsigned char c) {
+	if (matcher->numTokens == matcher->tokensCapacity) {
+		matcher->tokensCapacity = (matcher->tokensCapacity == 0) ? 64
+								: 2 * matcher->tokensCapacity;
+		matcher->tokens = realloc(matcher->tokens,
+							matcher->tokensCapacity * sizeof (globToken_t));
+		matcher->isInSet = realloc(matcher->isInSet,
+							matcher->tokensCapacity * sizeof (bool));
+		if (matcher->tokens == NULL || matcher->isInSet == NULL)
+			err(1, "failed to allocate %zu pattern tokens",
+				matcher->tokensCapacity);
+	}
+	globToken_t *token = &matcher->tokens[matcher->numTokens++];
+	memset(token, 0, sizeof (globToken_t));
+	token->type = type;
+	token->c = c;
+	token->pattern = matcher->numPatterns;
+	return (token);
+}
+
+/*
+ * parses the bracket expression after a '[' into the set of token, with
+ * ranges and a leading '!' or '^' negating it. Returns the closing ']',
+ * or NULL if there is none.
+ */
+char *parseGlobClass(char *cursor, globToken_t *token) {
+	bool isNegated = (*cursor == '!' || *cursor == '^');
+	if (isNegated)
+		cursor++;
+	char *first = cursor;
+	for (; *cursor != ']' || cursor == first; cursor++) {
+		if (*cursor == '\0')
+			return (NULL);
+		unsigned char low = *cursor;
+		unsigned char high = low;
+		if (cursor[1] == '-' && cursor[2] != ']' && cursor[2] != '\0') {
+			high = cursor[2];
+			cursor += 2;
+		}
+		for (unsigned int c = low; c <= high; c++)
+			token->set[c / 64] |= (uint64_t) 1 << (c % 64);
+	}
+	if (isNegated) {
+		for (int i = 0; i < 4; i++)
+			token->set[i] = ~token->set[i];
+	}
+	return (cursor);
+}
+
+/*
+ * adds position to the set under construction, along with the
+ * positions past the wildcards that can match nothing, and the end of
+ * the pattern after a GLOB_SUBTREE.
+ */
+void addGlobPosition(matcher_t *matcher, size_t position) {
+	while (!matcher->isInSet[position]) {
+		matcher->isInSet[position] = true;
+		int type = matcher->tokens[position].type;
+		if (type == GLOB_SUBTREE) {
+			position += 2;
+			continue;
+		}
+		if (type != GLOB_STAR && type != GLOB_GLOBSTAR &&
+			type != GLOB_GLOBSTAR_DIR)
+			break;
+		position++;
+	}
+}
+
+/*
+ * returns the state of the set of positions under construction, built
+ * if it is new, and clears the set.
+ */
+int findGlobState(matcher_t *matcher) {
+	size_t numPositions = 0;
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < matcher->numTokens; i++) {
+		if (matcher->isInSet[i]) {
+			numPositions++;
+			hash = (hash ^ i) * 1099511628211ULL;
+		}
+	}
+
+	for (size_t i = 0; i < matcher->numStates; i++) {
+		globState_t *state = matcher->states[i];
+		if (state->hash != hash || state->numPositions != numPositions)
+			continue;
+		size_t j = 0;
+		while (j < numPositions && matcher->isInSet[state->positions[j]])
+			j++;
+		if (j == numPositions) {
+			memset(matcher->isInSet, 0, matcher->numTokens * sizeof (bool));
+			return (i);
+		}
+	}
+
+	if (matcher->numStates == matcher->statesCapacity) {
+		matcher->statesCapacity = (matcher->statesCapacity == 0) ? 64
+								: 2 * matcher->statesCapacity;
+		matcher->states = realloc(matcher->states,
+							matcher->statesCapacity * sizeof (globState_t *));
+		if (matcher->states == NULL)
+			err(1, "failed to allocate %zu pattern states",
+				matcher->statesCapacity);
+	}
+	globState_t *new = xmalloc(sizeof (globState_t));
+	new->positions = xmalloc((numPositions + 1) * sizeof (int));
+	new->accepted = xmalloc((numPositions + 1) * sizeof (int));
+	new->numPositions = 0;
+	new->numAccepted = 0;
+	new->hash = hash;
+	new->matched = 0;
+	for (int c = 0; c < 256; c++)
+		new->next[c] = -1;
+	for (size_t i = 0; i < matcher->numTokens; i++) {
+		if (!matcher->isInSet[i])
+			continue;
+		new->positions[new->numPositions++] = i;
+		globToken_t *token = &matcher->tokens[i];
+		if (token->type != GLOB_ACCEPT)
+			continue;
+		new->accepted[new->numAccepted++] = token->pattern;
+		new->matched |= matcher->isExclude[token->pattern] ? MATCH_EXCLUDE
+					: MATCH_INCLUDE;
+	}
+	memset(matcher->isInSet, 0, matcher->numTokens * sizeof (bool));
+	matcher->states[matcher->numStates] = new;
+	return (matcher->numStates++);
+}
+
+/*
+ * returns the state reached from state on byte c, and caches it.
+ */
+int globTransition(matcher_t *matcher, int state, unsigned char c) {
+	globState_t *from = matcher->states[state];
+	bool isSeparator = (c == '/' && !matcher->isSlashMatched);
+	for (size_t i = 0; i < from->numPositions; i++) {
+		int position = from->positions[i];
+		globToken_t *token = &matcher->tokens[position];
+		switch (token->type) {
+		case GLOB_LITERAL:
+			if (c == token->c)
+				addGlobPosition(matcher, position + 1);
+			break;
+		case GLOB_ANY:
+			if (!isSeparator)
+				addGlobPosition(matcher, position + 1);
+			break;
+		case GLOB_CLASS:
+			if (!isSeparator && (token->set[c / 64] >> (c % 64) & 1))
+				addGlobPosition(matcher, position + 1);
+			break;
+		case GLOB_STAR:
+			if (!isSeparator)
+				addGlobPosition(matcher, position);
+			break;
+		case GLOB_GLOBSTAR:
+			addGlobPosition(matcher, position);
+			break;
+		case GLOB_GLOBSTAR_DIR:
+			addGlobPosition(matcher, position);
+			if (c == '/')
+				addGlobPosition(matcher, position + 1);
+			break;
+		case GLOB_SUBTREE:
+			if (c == '/')
+				addGlobPosition(matcher, position + 1);
+			break;
+		}
+	}
+	int next = findGlobState(matcher);
+	matcher->states[state]->next[c] = next;
+	return (next);
+}
+
+void resetGlobStates(matcher_t *matcher) {
+	for (size_t i = 0; i < matcher->numStates; i++) {
+		free(matcher->states[i]->positions);
+		free(matcher->states[i]->accepted);
+		free(matcher->states[i]);
+	}
+	matcher->numStates = 0;
+}
+
+/*
+ * matches name against every pattern at once and returns MATCH_INCLUDE
+ * and MATCH_EXCLUDE for the kinds of patterns it matched. The include
+ * patterns matched are marked. A name never builds more states than it
+ * has bytes, so the cache is dropped before one could overflow it.
+ */
+int matchName(matcher_t *matcher, char *name) {
+	enterPhase(PHASE_MATCH);
+	size_t len = strlen(name);
+	while (len > 0 && name[len - 1] == '/')
+		len--;
+	if (matcher->numStates + len >= GLOB_MAX_STATES)
+		resetGlobStates(matcher);
+	if (matcher->numStates == 0) {
+		for (size_t i = 0; i < matcher->numTokens; i++) {
+			if (i == 0 || matcher->tokens[i - 1].type == GLOB_ACCEPT)
+				addGlobPosition(matcher, i);
+		}
+		findGlobState(matcher);
+	}
+
+	int state = 0;
+	unsigned char *end = (unsigned char *) name + len;
+	for (unsigned char *c = (unsigned char *) name; c < end; c++) {
+		if (matcher->states[state]->numPositions == 0)
+			return (0);
+		int next = matcher->states[state]->next[*c];
+		state = (next != -1) ? next : globTransition(matcher, state, *c);
+	}
+
+	globState_t *final = matcher->states[state];
+	for (size_t i = 0; i < final->numAccepted; i++)
+		matcher->isMatched[final->accepted[i]] = true;
+	return (final->matched);
+}
+
+/*
+ * returns true if the member name is selected by the names in requested
+ * or the include patterns of matcher, all members when there are
+ * neither, and not excluded.
+ */
+bool isSelectedMember(memberTable_t *requested, matcher_t *matcher,
+		char *name) {
+	int matched = (matcher->numPatterns > 0) ? matchName(matcher, name) : 0;
+	if (matched & MATCH_EXCLUDE)
+		return (false);
+	if (requested->numMembers == 0 && matcher->numIncludes == 0)
+		return (true);
+	return ((matched & MATCH_INCLUDE) ||
+		findMember(requested, name) != NULL);
+}
+
+/*
+ * adds the include patterns of matcher that no member matched to
+ * filesNotFound and returns their number.
+ */
+int addUnmatchedPatterns(matcher_t *matcher, memberTable_t *filesNotFound) {
+	int numUnmatched = 0;
+	for (int i = 0; i < matcher->numPatterns; i++) {
+		if (!matcher->isExclude[i] && !matcher->isMatched[i]) {
+			addMember(filesNotFound, matcher->patterns[i], NULL);
+			numUnmatched++;
+		}
+	}
+	return (numUnmatched);
+}
+
+void exitNotFound(memberTable_t *filesNotFound) {
+	for (size_t i = 0; i < filesNotFound->numMembers; i++)
+		fprintf(stderr, MSG_PREFFIX " %s: Not found in archive\n",
+				filesNotFound->members[i].name);
+	fprintf(stderr, MSG_PREFFIX " Exiting with failure status due to"
+			" previous errors\n");
+	exit(ERROR_CODE_TWO);
+}
+
+int checkTruncatedFile(archive_t *archive) {
+	if (archive->reader == READER_MMAP || archive->reader == READER_SEEKABLE) {
+		if (archive->offset > archive->size)
+			return (-1);
+		return (0);
+	}
+	if (archive->reader == READER_STREAM) {
+		if (archive->isTruncated)
+			return (-1);
+		return (0);
+	}
+
+	FILE *tarArchive = archive->file;
+	long int currentPosition = ftell(tarArchive);
+	fseek(tarArchive, 0, SEEK_END);
+	long int fileSize = ftell(tarArchive);
+	fseek(tarArchive, currentPosition, SEEK_SET);
+	if (currentPosition > fileSize) {
+		return (-1);
+	}
+	return (0);
+}
+
+bool isTarFile(char *magicField) {
+	if (strcmp(magicField, TAR_MAGIC) == 0 ||
+		memcmp(magicField, POSIX_MAGIC, sizeof (POSIX_MAGIC) - 1) == 0)
+	{
+		return (true);
+	}
+	return (false);
+}
+
+/*
+ * returns true for the members that can be listed and extracted, regular
+ * files including sparse ones and directories.
+ */
+bool isSupportedMember(header_t *header) {
+	return (header->typeflag == REGTYPE || header->typeflag == AREGTYPE ||
+		header->typeflag == GNUTYPE_SPARSE || header->typeflag == DIRTYPE);
+}
+
+void *xmalloc(size_t len)
+{
+	assert(len != 0);
+	void *buf;
+	threadStats[STAT_ALLOCATIONS]++;
+	if ((buf = malloc(len)) == NULL)
+		err(1, "failed to allocate %zu bytes", len);
+	return (buf);
+}
+
+/*
+ * opens fileName for writing, created or truncated.
+ */
+int createFile(char *fileName) {
+	threadStats[STAT_FILES_OPENED]++;
+	return (open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+}
+
+dirCache_t *createDirCache(arena_t *arena) {
+	dirCache_t *new = xmalloc(sizeof (dirCache_t));
+	new->paths = createMemberTable(arena);
+	new->fds = NULL;
+	new->capacity = 0;
+	new->numOpen = 0;
+	new->generation = 0;
+	new->path = NULL;
+	new->pathSize = 0;
+	return (new);
+}
+
+void freeDirCache(dirCache_t *cache) {
+	closeDirectories(cache);
+	freeMemberTable(cache->paths);
+	free(cache->fds);
+	free(cache->path);
+	free(cache);
+}
+
+/*
+ * closes the open descriptors of the cache; the directories are still
+ * known to exist.
+ */
+void closeDirectories(dirCache_t *cache) {
+	for (size_t i = 0; i < cache->paths->numMembers; i++) {
+		if (cache->fds[i] != -1) {
+			close(cache->fds[i]);
+			cache->fds[i] = -1;
+		}
+	}
+	cache->numOpen = 0;
+	cache->generation++;
+}
+
+/*
+ * returns a descriptor of the directory path, which is changed while the
+ * call runs, creating it and its parents as needed. Paths are relative
+ * to the current directory. Returns -1 if a directory cannot be created
+ * or opened.
+ */
+int openDirectory(dirCache_t *cache, char *path) {
+	member_t *dir = findMember(cache->paths, path);
+	ssize_t dirNumber = (dir != NULL) ? dir - cache->paths->members : -1;
+	if (dirNumber != -1 && cache->fds[dirNumber] != -1)
+		return (cache->fds[dirNumber]);
+
+	int parentFd = AT_FDCWD;
+	char *baseName = path;
+	char *slash = strrchr(path, '/');
+	if (slash != NULL) {
+		*slash = '\0';
+		parentFd = openDirectory(cache, path);
+		*slash = '/';
+		baseName = slash + 1;
+	}
+	/* a name with consecutive slashes */
+	if (parentFd == -1 || *baseName == '\0')
+		return (parentFd);
+	if (dirNumber == -1 && mkdirat(parentFd, baseName, 0777) == -1 &&
+		errno != EEXIST)
+		return (-1);
+	threadStats[STAT_FILES_OPENED]++;
+	int fd = openat(parentFd, baseName, O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		return (-1);
+
+	if (dirNumber == -1) {
+		addMember(cache->paths, path, NULL);
+		dirNumber = cache->paths->numMembers - 1;
+		if (cache->paths->numMembers > cache->capacity) {
+			cache->capacity = cache->paths->capacity;
+			cache->fds = realloc(cache->fds, cache->capacity * sizeof (int));
+			if (cache->fds == NULL)
+				err(1, "failed to allocate %zu directories", cache->capacity);
+		}
+	}
+	cache->fds[dirNumber] = fd;
+	cache->numOpen++;
+	return (fd);
+}
+
+/*
+ * returns a descriptor of the directory of fileName, AT_FDCWD for a name
+ * without one, creating it as needed, and sets baseName to the name of
+ * the file within it.
+ */
+int openParentDirectory(dirCache_t *cache, char *fileName, char **baseName) {
+	char *slash = strrchr(fileName, '/');
+	if (slash == NULL) {
+		*baseName = fileName;
+		return (AT_FDCWD);
+	}
+	*baseName = slash + 1;
+
+	size_t len = slash - fileName;
+	if (len + 1 > cache->pathSize) {
+		cache->pathSize = 2 * (len + 1);
+		free(cache->path);
+		cache->path = xmalloc(cache->pathSize);
+	}
+	memcpy(cache->path, fileName, len);
+	cache->path[len] = '\0';
+	if (cache->numOpen >= DIR_CACHE_MAX_FDS)
+		closeDirectories(cache);
+	return (openDirectory(cache, cache->path));
+}
+
+/*
+ * creates the directory of a directory member, whose name may end in
+ * slashes, and its parents. Returns -1 on failure.
+ */
+int makeDirectory(dirCache_t *cache, char *dirName) {
+	size_t len = strlen(dirName);
+	while (len > 0 && dirName[len - 1] == '/')
+		len--;
+	if (len == 0)
+		return (0);
+
+	/* the directory is the parent of a file with an empty name */
+	char *fileName = xmalloc(len + 2);
+	memcpy(fileName, dirName, len);
+	strcpy(fileName + len, "/");
+	char *baseName;
+	int fd = openParentDirectory(cache, fileName, &baseName);
+	free(fileName);
+	return ((fd == -1) ? -1 : 0);
+}
+
+/*
+ * creates or truncates the file of a member in its directory.
+ */
+int createMemberFile(dirCache_t *dirs, char *fileName) {
+	char *baseName;
+	int dirFd = openParentDirectory(dirs, fileName, &baseName);
+	if (dirFd == -1)
+		return (-1);
+	threadStats[STAT_FILES_OPENED]++;
+	return (openat(dirFd, baseName, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+}
+
+/*
+ * sets the modification time of fd, unless mtime is -1.
+ */
+void setFileMtime(int fd, int64_t mtime) {
+	if (mtime < 0)
+		return;
+	struct timespec times[2] = { { 0, UTIME_OMIT }, { mtime, 0 } };
+	futimens(fd, times);
+}
+
+void extractEmptyFile(dirCache_t *dirs, char *fileName, int64_t mtime) {
+	int fd = createMemberFile(dirs, fileName);
+	if (fd == -1) {
+		printf("Error creating the file: %s\n", fileName);
+	} else {
+		setFileMtime(fd, mtime);
+		close(fd);
+	}
+}
+
+/*
+ * returns the name a member is extracted to, as GNU tar does: without
+ * its leading slashes, which is said once per run, or NULL, having said
+ * why, if a ".." component could take it out of the current directory.
+ */
+char *extractedName(char *fileName) {
+	char *name = fileName;
+	while (*name == '/')
+		name++;
+	for (char *component = name; *component != '\0'; ) {
+		size_t len = strcspn(component, "/");
+		if (len == 2 && strncmp(component, "..", 2) == 0) {
+			printf(MSG_PREFFIX " %s: Member name contains '..'\n", fileName);
+			return (NULL);
+		}
+		component += len;
+		while (*component == '/')
+			component++;
+	}
+	if (name != fileName &&
+		!__atomic_exchange_n(&isSlashRemovalNoticed, true, __ATOMIC_RELAXED))
+		printf(MSG_PREFFIX " Removing leading `/' from member names\n");
+	return (name);
+}
+
+/*
+ * extracts the current member of the iterator into fileName, less its
+ * leading slashes, creating the directories on its path through dirs. A
+ * member whose name has a ".." component is skipped. With a pool the data is
+ * queued for a worker and the archive moves past it right away; sparse
+ * members and directories are always extracted here. With
+ * skipUnchanged a file that already holds the member is left alone, and
+ * the files written get the mtime of their member so that the next run
+ * can tell. Returns EXTRACT_TRUNCATED if the archive ends before the
+ * member, padding included, does.
+ */
+int extractFile(iterator_t *iterator, char *fileName, int *posZeroBlock,
+		extractPool_t *pool, dirCache_t *dirs, int skipUnchanged) {
+	enterPhase(PHASE_COPY);
+	archive_t *archive = iterator->archive;
+	size_t bytesToRead = iterator->dataLeft;
+	fileName = extractedName(fileName);
+	if (fileName == NULL || iterator->header->typeflag == DIRTYPE) {
+		if (fileName != NULL && makeDirectory(dirs, fileName) == -1)
+			printf("Error creating the directory: %s\n", fileName);
+		*posZeroBlock += bytesToRead / BLOCKSIZE_BYTES;
+		return ((skipMember(iterator) == TAR_OK) ? EXTRACT_DONE
+				: EXTRACT_TRUNCATED);
+	}
+
+	int64_t mtime = -1;
+	if (skipUnchanged != UNCHANGED_OFF) {
+		mtime = parseNumeric(iterator->header->mtime,
+					sizeof (iterator->header->mtime));
+		int result = updateExistingFile(iterator, dirs, fileName, mtime,
+						skipUnchanged);
+		if (result != EXTRACT_PENDING) {
+			*posZeroBlock += bytesToRead / BLOCKSIZE_BYTES;
+			return (result);
+		}
+	}
+
+	if (pool != NULL && iterator->sparse == NULL) {
+		char *baseName;
+		int dirFd = openParentDirectory(dirs, fileName, &baseName);
+		if (dirFd == -1) {
+			printf("Error creating the file: %s\n", fileName);
+			*posZeroBlock += bytesToRead / BLOCKSIZE_BYTES;
+			return ((skipMember(iterator) == TAR_OK) ? EXTRACT_DONE
+					: EXTRACT_TRUNCATED);
+		}
+		size_t available = 0;
+		if (archive->offset < archive->size)
+			available = archive->size - archive->offset;
+		size_t bytesRead = (bytesToRead < available) ? bytesToRead : available;
+		size_t bytesToWrite = (iterator->contentLeft < bytesRead)
+							? iterator->contentLeft : bytesRead;
+		queueExtractJob(pool, dirs, dirFd, fileName, baseName, archive->offset,
+			bytesToWrite, mtime);
+		archive->offset += bytesRead;
+		iterator->contentLeft = 0;
+		iterator->dataLeft = 0;
+		*posZeroBlock += (bytesRead + BLOCKSIZE_BYTES - 1) / BLOCKSIZE_BYTES;
+		return ((bytesRead == bytesToRead) ? EXTRACT_DONE : EXTRACT_TRUNCATED);
+	}
+
+	if (bytesToRead == 0 && iterator->sparse == NULL) {
+		extractEmptyFile(dirs, fileName, mtime);
+		return (EXTRACT_DONE);
+	}
+
+	int fd = createMemberFile(dirs, fileName);
+	if (fd == -1) {
+		printf("Error creating the file: %s\n", fileName);
+		skipMember(iterator);
+		return (EXTRACT_DONE);
+	}
+
+	int status = writeMemberData(iterator, fd);
+	if (status == TAR_OK)
+		setFileMtime(fd, mtime);
+	adviseClosing(iterator->archive, fd);
+	close(fd);
+	if (status == TAR_ERR_IO)
+		exit(EXIT_FAILURE);
+	size_t bytesRead = bytesToRead - iterator->dataLeft;
+	*posZeroBlock += (bytesRead + BLOCKSIZE_BYTES - 1) / BLOCKSIZE_BYTES;
+
+	/* the archive ended inside the member, which is reported after the
+	 * scan finds no more headers */
+	iterator->contentLeft = 0;
+	iterator->dataLeft = 0;
+	return ((status == TAR_OK) ? EXTRACT_DONE : EXTRACT_TRUNCATED);
+}
+
+/*
+ * skips the current member if fileName already holds it: a regular file
+ * of its size with its mtime or, with UNCHANGED_CONTENTS, with its
+ * contents. Contents are compared chunk by chunk as the member is read,
+ * and a file that differs is only rewritten from the first chunk that
+ * does. Returns EXTRACT_PENDING, having read nothing, if the member is
+ * to be extracted as usual. Links are never followed: a destination that
+ * is not a regular file counts as changed and, unless a directory, is
+ * removed first so that the member is not written through it.
+ */
+int updateExistingFile(iterator_t *iterator, dirCache_t *dirs,
+		char *fileName, int64_t mtime, int skipUnchanged) {
+	char *baseName;
+	int dirFd = openParentDirectory(dirs, fileName, &baseName);
+	struct stat st;
+	if (dirFd == -1 ||
+		fstatat(dirFd, baseName, &st, AT_SYMLINK_NOFOLLOW) == -1)
+		return (EXTRACT_PENDING);
+	if (!S_ISREG(st.st_mode)) {
+		if (!S_ISDIR(st.st_mode))
+			unlinkat(dirFd, baseName, 0);
+		return (EXTRACT_PENDING);
+	}
+	uint64_t size = (iterator->sparse != NULL) ? iterator->sparse->realSize
+					: iterator->size;
+	if ((uint64_t) st.st_size != size)
+		return (EXTRACT_PENDING);
+	/* an empty file has no contents to compare */
+	if (skipUnchanged == UNCHANGED_STAT || size == 0) {
+		if (st.st_mtime != mtime)
+			return (EXTRACT_PENDING);
+		return ((skipMember(iterator) == TAR_OK) ? EXTRACT_UNCHANGED
+				: EXTRACT_TRUNCATED);
+	}
+	if (iterator->sparse != NULL)
+		return (EXTRACT_PENDING);
+
+	int fd = openat(dirFd, baseName, O_RDWR | O_NOFOLLOW);
+	threadStats[STAT_FILES_OPENED]++;
+	if (fd == -1)
+		return (EXTRACT_PENDING);
+
+	int result = EXTRACT_UNCHANGED;
+	size_t chunkSize = (size < COPY_BUFFER_BYTES) ? size : COPY_BUFFER_BYTES;
+	char *memberData = xmalloc(2 * chunkSize);
+	char *fileData = memberData + chunkSize;
+	off_t offset = 0;
+	while (result == EXTRACT_UNCHANGED && iterator->contentLeft > 0) {
+		ssize_t len = readMemberData(iterator, memberData, chunkSize);
+		if (len == TAR_ERR_IO)
+			exit(EXIT_FAILURE);
+		if (len < 0) {
+			result = EXTRACT_TRUNCATED;
+			break;
+		}
+		ssize_t fileLen = pread(fd, fileData, len, offset);
+		threadStats[STAT_BYTES_READ] += (fileLen > 0) ? fileLen : 0;
+		if (fileLen != len || memcmp(memberData, fileData, len) != 0) {
+			if (lseek(fd, offset, SEEK_SET) == -1)
+				exit(EXIT_FAILURE);
+			writeOrExit(fd, memberData, len);
+			int status = writeMemberData(iterator, fd);
+			if (status == TAR_ERR_IO)
+				exit(EXIT_FAILURE);
+			result = (status == TAR_OK) ? EXTRACT_DONE : EXTRACT_TRUNCATED;
+		}
+		offset += len;
+	}
+	if (result != EXTRACT_TRUNCATED && st.st_mtime != mtime)
+		setFileMtime(fd, mtime);
+	close(fd);
+	free(memberData);
+	if (result == EXTRACT_TRUNCATED) {
+		iterator->contentLeft = 0;
+		iterator->dataLeft = 0;
+	}
+	return (result);
+}
+
+/*
+ * consumes bytesToRead bytes of the archive, the data of a member and its
+ * padding, and writes the first contentSize of them to fdOut. Data of a
+ * mapped archive is moved inside the kernel with copy_file_range, or
+ * sendfile where that is not supported, and written from the mapping as
+ * a last resort. Other archives are copied through a large buffer.
+ * Returns the number of bytes consumed, which is less than bytesToRead
+ * only if the archive ends first or cannot be read, which sets its
+ * error.
+ */
+size_t copyMemberData(archive_t *archive, int fdOut, size_t contentSize,
+		size_t bytesToRead) {
+	if (archive->reader == READER_MMAP) {
+		size_t available = 0;
+		if (archive->offset < archive->size)
+			available = archive->size - archive->offset;
+		size_t bytesRead = (bytesToRead < available) ? bytesToRead : available;
+		size_t bytesToWrite = (contentSize < bytesRead) ? contentSize : bytesRead;
+		if (!copyRange(archive, archive->offset, fdOut, bytesToWrite,
+				&archive->copyMethod))
+			archive->error = TAR_ERR_IO;
+		archive->offset += bytesRead;
+		return (bytesRead);
+	}
+
+	/* only used for the page cache hints */
+	size_t position = 0;
+	if (archive->ioPolicy != IO_CACHE)
+		position = lseek(fdOut, 0, SEEK_CUR);
+
+	if (archive->reader == READER_SEEKABLE) {
+		size_t totalRead = 0;
+		while (totalRead < bytesToRead) {
+			char *data;
+			size_t available = peekSeekable(archive, &data);
+			if (available == 0)
+				break;
+			if (available > bytesToRead - totalRead)
+				available = bytesToRead - totalRead;
+			if (totalRead < contentSize) {
+				size_t bytesToWrite = contentSize - totalRead;
+				if (bytesToWrite > available)
+					bytesToWrite = available;
+				if (!writeAll(fdOut, data, bytesToWrite)) {
+					archive->error = TAR_ERR_IO;
+					break;
+				}
+				adviseWritten(archive, fdOut, position,
+					position + bytesToWrite);
+				position += bytesToWrite;
+			}
+			archive->offset += available;
+			totalRead += available;
+		}
+		threadStats[STAT_BYTES_READ] += totalRead;
+		return (totalRead);
+	}
+
+	if (archive->reader == READER_STREAM) {
+		size_t totalRead = 0;
+		while (totalRead < bytesToRead) {
+			char *data;
+			size_t available = peekStream(archive->stream, &data);
+			if (available == 0)
+				break;
+			if (available > bytesToRead - totalRead)
+				available = bytesToRead - totalRead;
+			if (totalRead < contentSize) {
+				size_t bytesToWrite = contentSize - totalRead;
+				if (bytesToWrite > available)
+					bytesToWrite = available;
+				if (!writeAll(fdOut, data, bytesToWrite)) {
+					archive->error = TAR_ERR_IO;
+					break;
+				}
+				adviseWritten(archive, fdOut, position,
+					position + bytesToWrite);
+				position += bytesToWrite;
+			}
+			consumeStream(archive->stream, available);
+			totalRead += available;
+		}
+		if (totalRead < bytesToRead && archive->error == TAR_OK)
+			archive->error = archive->stream->error;
+		archive->offset += totalRead;
+		threadStats[STAT_BYTES_READ] += totalRead;
+		return (totalRead);
+	}
+
+	if (archive->copyBuffer == NULL)
+		archive->copyBuffer = xmalloc(COPY_BUFFER_BYTES);
+
+	size_t totalRead = 0;
+	while (totalRead < bytesToRead) {
+		size_t len = bytesToRead - totalRead;
+		if (len > COPY_BUFFER_BYTES)
+			len = COPY_BUFFER_BYTES;
+		size_t bytesRead = fread(archive->copyBuffer, sizeof (char), len,
+							archive->file);
+		if (ferror(archive->file)) {
+			archive->error = TAR_ERR_IO;
+			break;
+		}
+
+		if (totalRead < contentSize) {
+			size_t bytesToWrite = contentSize - totalRead;
+			if (bytesToWrite > bytesRead)
+				bytesToWrite = bytesRead;
+			if (!writeAll(fdOut, archive->copyBuffer, bytesToWrite)) {
+				archive->error = TAR_ERR_IO;
+				break;
+			}
+			adviseWritten(archive, fdOut, position, position + bytesToWrite);
+			position += bytesToWrite;
+		}
+		totalRead += bytesRead;
+		if (bytesRead < len)
+			break;
+	}
+	threadStats[STAT_BYTES_READ] += totalRead;
+	return (totalRead);
+}
+
+/*
+ * writes len bytes at offset of a mapped archive to fdOut without moving
+ * the archive position, with the method in *copyMethod or a slower one
+ * if that fails. Safe to call from several threads with their own
+ * copyMethod. Outside IO_CACHE it copies a window at a time, dropping
+ * the archive pages copied and writing back the file as it goes. Returns
+ * false, with errno set, if a copy or write fails.
+ */
+bool copyRange(archive_t *archive, size_t offset, int fdOut, size_t len,
+		int *copyMethod) {
+	if (archive->ioPolicy == IO_DIRECT && len >= DIRECT_MIN_BYTES) {
+		int copied = copyRangeDirect(archive, offset, fdOut, len);
+		if (copied != 0)
+			return (copied == 1);
+	}
+
+	int fdIn = archive->fd;
+	off_t offsetIn = offset;
+	size_t position = 0;
+	if (archive->ioPolicy != IO_CACHE)
+		position = lseek(fdOut, 0, SEEK_CUR);
+	while (len > 0) {
+		size_t chunk = len;
+		if (archive->ioPolicy != IO_CACHE && chunk > IO_WINDOW_BYTES)
+			chunk = IO_WINDOW_BYTES;
+		ssize_t copied = -1;
+		if (*copyMethod == COPY_FILE_RANGE) {
+			copied = copy_file_range(fdIn, &offsetIn, fdOut, NULL, chunk, 0);
+			if (copied == -1 && errno != EIO && errno != ENOSPC &&
+				errno != EDQUOT) {
+				*copyMethod = COPY_SENDFILE;
+				continue;
+			}
+		} else if (*copyMethod == COPY_SENDFILE) {
+			copied = sendfile(fdOut, fdIn, &offsetIn, chunk);
+			if (copied == -1 && (errno == EINVAL || errno == ENOSYS)) {
+				*copyMethod = COPY_WRITE;
+				continue;
+			}
+		} else {
+			if (!writeAll(fdOut, archive->map + offsetIn, chunk))
+				return (false);
+			copied = chunk;
+			offsetIn += copied;
+		}
+
+		if (copied == -1)
+			return (false);
+		if (copied == 0)
+			break;
+		threadStats[STAT_BYTES_READ] += copied;
+		if (*copyMethod != COPY_WRITE)
+			threadStats[STAT_BYTES_WRITTEN] += copied;
+		len -= copied;
+		if (archive->ioPolicy != IO_CACHE) {
+			posix_fadvise(fdIn, offsetIn - copied, copied, POSIX_FADV_DONTNEED);
+			adviseWritten(archive, fdOut, position, position + copied);
+		}
+		position += copied;
+	}
+	return (true);
+}
+
+/*
+ * writes len bytes at offset of a mapped archive to fdOut with O_DIRECT,
+ * through an aligned buffer, and the tail that is not a whole number of
+ * DIRECT_ALIGN_BYTES without it. Returns 1 once written, 0, having
+ * written nothing, if fdOut is not at an aligned position or its file
+ * system refuses O_DIRECT, and -1 if a write fails.
+ */
+int copyRangeDirect(archive_t *archive, size_t offset, int fdOut,
+		size_t len) {
+	int flags = fcntl(fdOut, F_GETFL);
+	off_t position = lseek(fdOut, 0, SEEK_CUR);
+	if (flags == -1 || position == -1 || position % DIRECT_ALIGN_BYTES != 0 ||
+		fcntl(fdOut, F_SETFL, flags | O_DIRECT) == -1)
+		return (0);
+
+	char *buffer;
+	if (posix_memalign((void **) &buffer, DIRECT_ALIGN_BYTES,
+			DIRECT_BUFFER_BYTES) != 0)
+		errx(1, "failed to allocate %d bytes", DIRECT_BUFFER_BYTES);
+
+	size_t alignedLen = len - len % DIRECT_ALIGN_BYTES;
+	size_t totalWritten = 0;
+	while (totalWritten < alignedLen) {
+		size_t chunk = alignedLen - totalWritten;
+		if (chunk > DIRECT_BUFFER_BYTES)
+			chunk = DIRECT_BUFFER_BYTES;
+		memcpy(buffer, archive->map + offset + totalWritten, chunk);
+		ssize_t written = write(fdOut, buffer, chunk);
+		if (written == -1 && errno == EINTR)
+			continue;
+		if (written == -1 && errno == EINVAL && totalWritten == 0) {
+			fcntl(fdOut, F_SETFL, flags);
+			free(buffer);
+			return (0);
+		}
+		if (written <= 0)
+			break;
+		totalWritten += written;
+		threadStats[STAT_BYTES_WRITTEN] += written;
+	}
+	free(buffer);
+	fcntl(fdOut, F_SETFL, flags);
+	if (totalWritten < alignedLen)
+		return (-1);
+
+	if (totalWritten < len &&
+		!writeAll(fdOut, archive->map + offset + totalWritten,
+			len - totalWritten))
+		return (-1);
+	posix_fadvise(archive->fd, offset, len, POSIX_FADV_DONTNEED);
+	threadStats[STAT_BYTES_READ] += len;
+	return (1);
+}
+
+/*
+ * outside IO_CACHE, starts writing back the windows of fd completed by
+ * the bytes from start to end just written, and waits for the ones
+ * before them to drop them from the page cache, so that a large file
+ * being extracted keeps about two windows of it in the cache.
+ */
+void adviseWritten(archive_t *archive, int fd, size_t start, size_t end) {
+	if (archive->ioPolicy == IO_CACHE ||
+		start / IO_WINDOW_BYTES == end / IO_WINDOW_BYTES)
+		return;
+	size_t from = start - start % IO_WINDOW_BYTES;
+	size_t to = end - end % IO_WINDOW_BYTES;
+	sync_file_range(fd, from, to - from, SYNC_FILE_RANGE_WRITE);
+	size_t dropFrom = (from >= IO_WINDOW_BYTES) ? from - IO_WINDOW_BYTES : 0;
+	size_t dropTo = to - IO_WINDOW_BYTES;
+	if (dropTo > dropFrom) {
+		sync_file_range(fd, dropFrom, dropTo - dropFrom,
+			SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE
+			| SYNC_FILE_RANGE_WAIT_AFTER);
+		posix_fadvise(fd, dropFrom, dropTo - dropFrom, POSIX_FADV_DONTNEED);
+	}
+}
+
+/*
+ * outside IO_CACHE, starts writing back a file extracted from archive
+ * about to be closed and drops whatever of it is already clean from the
+ * page cache. It does not wait, so small files are only written back
+ * early.
+ */
+void adviseClosing(archive_t *archive, int fd) {
+	if (archive->ioPolicy == IO_CACHE)
+		return;
+	sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+/*
+ * outside IO_CACHE, asks for the window of a mapped archive after its
+ * position once it moves a window further, and drops from the map and
+ * the page cache what lies more than a window behind it. With an
+ * extraction pool the workers drop the data they copy instead.
+ */
+void adviseArchive(archive_t *archive) {
+	if (!archive->isDroppingBehind ||
+		archive->offset < archive->droppedOffset + 2 * IO_WINDOW_BYTES)
+		return;
+	size_t end = archive->offset - IO_WINDOW_BYTES;
+	end -= end % IO_WINDOW_BYTES;
+	madvise(archive->map + archive->droppedOffset,
+		end - archive->droppedOffset, MADV_DONTNEED);
+	posix_fadvise(archive->fd, archive->droppedOffset,
+		end - archive->droppedOffset, POSIX_FADV_DONTNEED);
+	archive->droppedOffset = end;
+	posix_fadvise(archive->fd, archive->offset, IO_WINDOW_BYTES,
+		POSIX_FADV_WILLNEED);
+}
+
+extractPool_t *createExtractPool(archive_t *archive, int numThreads) {
+	extractPool_t *new = xmalloc(sizeof (extractPool_t));
+	new->archive = archive;
+	/* members still queued may lie behind the position */
+	archive->isDroppingBehind = false;
+	new->uring = NULL;
+	new->arena = createArena();
+	new->totals = threadTotals;
+	new->threads = NULL;
+	if (numThreads > 0)
+		new->threads = xmalloc(numThreads * sizeof (pthread_t));
+	new->numThreads = numThreads;
+	new->jobs = NULL;
+	new->numJobs = 0;
+	new->capacity = 0;
+	new->lastDir = NULL;
+	new->nextJob = 0;
+	new->numJobsDone = 0;
+	new->isClosed = false;
+	pthread_mutex_init(&new->lock, NULL);
+	pthread_cond_init(&new->jobQueued, NULL);
+	pthread_cond_init(&new->jobDone, NULL);
+	for (int i = 0; i < numThreads; i++) {
+		if (pthread_create(&new->threads[i], NULL, extractWorker, new) != 0)
+			errx(1, "failed to create extraction thread");
+	}
+	return (new);
+}
+
+/*
+ * queues the extraction of fileName, created as baseName in the
+ * directory dirFd of dirs.
+ */
+void queueExtractJob(extractPool_t *pool, dirCache_t *dirs, int dirFd,
+		char *fileName, char *baseName, size_t offset, size_t bytesToWrite,
+		int64_t mtime) {
+	/* io_uring has no request setting times, so those files are written
+	 * here like the large ones */
+	if (pool->uring != NULL &&
+		(bytesToWrite > URING_MAX_WRITE_BYTES || mtime >= 0)) {
+		threadStats[STAT_FILES_OPENED]++;
+		int fd = openat(dirFd, baseName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd == -1)
+			printf("Error creating the file: %s\n", fileName);
+		else {
+			if (!copyRange(pool->archive, offset, fd, bytesToWrite,
+					&pool->archive->copyMethod))
+				exit(EXIT_FAILURE);
+			setFileMtime(fd, mtime);
+			adviseClosing(pool->archive, fd);
+			close(fd);
+		}
+		return;
+	}
+
+	char *name = arenaAlloc(pool->arena, strlen(fileName) + 1);
+	strcpy(name, fileName);
+	jobDir_t *dir = holdJobDir(pool, dirs, dirFd);
+	char *jobBaseName = (dir != NULL) ? name + (baseName - fileName) : name;
+	if (pool->uring != NULL) {
+		queueUringJob(pool->uring, dir, name, jobBaseName,
+			pool->archive->map + offset, bytesToWrite);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->numJobs == pool->capacity) {
+		pool->capacity = (pool->capacity == 0) ? 1024 : pool->capacity * 2;
+		pool->jobs = realloc(pool->jobs, pool->capacity * sizeof (extractJob_t));
+		if (pool->jobs == NULL)
+			err(1, "failed to allocate %zu jobs", pool->capacity);
+	}
+	extractJob_t *job = &pool->jobs[pool->numJobs++];
+	job->name = name;
+	job->baseName = jobBaseName;
+	job->dir = dir;
+	job->offset = offset;
+	job->bytesToWrite = bytesToWrite;
+	job->mtime = mtime;
+	pthread_cond_signal(&pool->jobQueued);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * returns the directory for a job created in dirFd of dirs, holding a
+ * reference to it, which is the one of the previous job if that was in
+ * the same directory. Returns NULL for the current directory, or if no
+ * descriptor is left to duplicate, the job then opening its whole path.
+ */
+jobDir_t *holdJobDir(extractPool_t *pool, dirCache_t *dirs, int dirFd) {
+	if (dirFd == AT_FDCWD)
+		return (NULL);
+	jobDir_t *dir = pool->lastDir;
+	if (dir == NULL || dir->cacheFd != dirFd ||
+		dir->generation != dirs->generation) {
+		int fd = dup(dirFd);
+		if (fd == -1)
+			return (NULL);
+		dir = xmalloc(sizeof (jobDir_t));
+		dir->fd = fd;
+		dir->cacheFd = dirFd;
+		dir->generation = dirs->generation;
+		dir->numRefs = 1;
+		pthread_mutex_lock(&pool->lock);
+		if (pool->lastDir != NULL)
+			releaseJobDir(pool->lastDir);
+		pool->lastDir = dir;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	pthread_mutex_lock(&pool->lock);
+	dir->numRefs++;
+	pthread_mutex_unlock(&pool->lock);
+	return (dir);
+}
+
+/*
+ * drops a reference to dir, with the lock of its pool held if the pool
+ * has workers.
+ */
+void releaseJobDir(jobDir_t *dir) {
+	if (dir == NULL || --dir->numRefs > 0)
+		return;
+	close(dir->fd);
+	free(dir);
+}
+
+/*
+ * waits until every queued job is done, e.g. before queueing a member
+ * whose name is already queued, so that the last one wins as when
+ * extracting sequentially.
+ */
+void waitExtractPool(extractPool_t *pool) {
+	enterPhase(PHASE_COPY);
+	if (pool->uring != NULL) {
+		waitUring(pool->uring);
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	while (pool->numJobsDone < pool->numJobs)
+		pthread_cond_wait(&pool->jobDone, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void finishExtractPool(extractPool_t *pool) {
+	enterPhase(PHASE_COPY);
+	if (pool->uring != NULL) {
+		waitUring(pool->uring);
+		closeUring(pool->uring);
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->isClosed = true;
+	pthread_cond_broadcast(&pool->jobQueued);
+	pthread_mutex_unlock(&pool->lock);
+	for (int i = 0; i < pool->numThreads; i++)
+		pthread_join(pool->threads[i], NULL);
+	releaseJobDir(pool->lastDir);
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->jobQueued);
+	pthread_cond_destroy(&pool->jobDone);
+	releaseArena(pool->arena);
+	free(pool->arena);
+	free(pool->jobs);
+	free(pool->threads);
+	free(pool);
+}
+
+void *extractWorker(void *arg) {
+	extractPool_t *pool = arg;
+	threadTotals = pool->totals;
+	int copyMethod = COPY_FILE_RANGE;
+
+	pthread_mutex_lock(&pool->lock);
+	while (1) {
+		while (pool->nextJob == pool->numJobs && !pool->isClosed)
+			pthread_cond_wait(&pool->jobQueued, &pool->lock);
+		if (pool->nextJob == pool->numJobs)
+			break;
+		extractJob_t job = pool->jobs[pool->nextJob++];
+		pthread_mutex_unlock(&pool->lock);
+		enterPhase(PHASE_COPY);
+
+		threadStats[STAT_FILES_OPENED]++;
+		int fd = openat((job.dir != NULL) ? job.dir->fd : AT_FDCWD,
+					job.baseName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd == -1)
+			printf("Error creating the file: %s\n", job.name);
+		else {
+			if (!copyRange(pool->archive, job.offset, fd, job.bytesToWrite,
+					&copyMethod))
+				exit(EXIT_FAILURE);
+			setFileMtime(fd, job.mtime);
+			adviseClosing(pool->archive, fd);
+			close(fd);
+		}
+
+		enterPhase(PHASE_OTHER);
+		pthread_mutex_lock(&pool->lock);
+		releaseJobDir(job.dir);
+		pool->numJobsDone++;
+		pthread_cond_broadcast(&pool->jobDone);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	mergeThreadStats();
+	return (NULL);
+}
+
+/*
+ * returns a pool extracting members of a mapped archive through
+ * io_uring, or NULL if the kernel does not provide what it needs, in
+ * which case members are extracted as usual.
+ */
+extractPool_t *createUringPool(archive_t *archive, int queueDepth) {
+	uring_t *uring = openUring(queueDepth);
+	if (uring == NULL)
+		return (NULL);
+
+	extractPool_t *new = createExtractPool(archive, 0);
+	new->uring = uring;
+	return (new);
+}
+
+uring_t *openUring(int queueDepth) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof (params));
+	int fd = syscall(__NR_io_uring_setup, 4 * queueDepth, &params);
+	if (fd == -1)
+		return (NULL);
+
+	/* skipping the completions of successful requests came after
+	 * opening into and writing to registered file slots */
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+		!(params.features & IORING_FEAT_CQE_SKIP)) {
+		close(fd);
+		return (NULL);
+	}
+
+	uring_t *new = xmalloc(sizeof (uring_t));
+	new->fd = fd;
+	new->ringSize = params.sq_off.array + params.sq_entries
+					* sizeof (unsigned);
+	size_t cqRingSize = params.cq_off.cqes + params.cq_entries
+					* sizeof (struct io_uring_cqe);
+	if (cqRingSize > new->ringSize)
+		new->ringSize = cqRingSize;
+	new->ring = mmap(NULL, new->ringSize, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (new->ring == MAP_FAILED)
+		err(1, "failed to map io_uring");
+	new->sqesSize = params.sq_entries * sizeof (struct io_uring_sqe);
+	new->sqes = mmap(NULL, new->sqesSize, PROT_READ | PROT_WRITE,
+					MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (new->sqes == MAP_FAILED)
+		err(1, "failed to map io_uring");
+
+	new->sqHead = (unsigned *) (new->ring + params.sq_off.head);
+	new->sqTail = (unsigned *) (new->ring + params.sq_off.tail);
+	new->sqMask = (unsigned *) (new->ring + params.sq_off.ring_mask);
+	new->sqArray = (unsigned *) (new->ring + params.sq_off.array);
+	new->cqHead = (unsigned *) (new->ring + params.cq_off.head);
+	new->cqTail = (unsigned *) (new->ring + params.cq_off.tail);
+	new->cqMask = (unsigned *) (new->ring + params.cq_off.ring_mask);
+	new->cqes = (struct io_uring_cqe *) (new->ring + params.cq_off.cqes);
+	new->numToSubmit = 0;
+
+	new->queueDepth = queueDepth;
+	new->freeSlots = xmalloc(queueDepth * sizeof (int));
+	new->names = xmalloc(queueDepth * sizeof (char *));
+	new->dirs = xmalloc(queueDepth * sizeof (jobDir_t *));
+	new->numFreeSlots = queueDepth;
+
+	/* register empty file slots, filled by the openat of every member */
+	for (int i = 0; i < queueDepth; i++)
+		new->freeSlots[i] = -1;
+	int ret = syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES,
+				new->freeSlots, queueDepth);
+	for (int i = 0; i < queueDepth; i++)
+		new->freeSlots[i] = i;
+	if (ret == -1) {
+		closeUring(new);
+		return (NULL);
+	}
+	return (new);
+}
+
+void closeUring(uring_t *uring) {
+	munmap(uring->sqes, uring->sqesSize);
+	munmap(uring->ring, uring->ringSize);
+	close(uring->fd);
+	free(uring->freeSlots);
+	free(uring->names);
+	free(uring->dirs);
+	free(uring);
+}
+
+/*
+ * returns the next free submission queue entry, cleared. The queue holds
+ * the requests of every member in flight, so it never runs out.
+ */
+struct io_uring_sqe *getUringSqe(uring_t *uring) {
+	unsigned tail = *uring->sqTail + uring->numToSubmit;
+	unsigned index = tail & *uring->sqMask;
+	struct io_uring_sqe *sqe = &uring->sqes[index];
+	memset(sqe, 0, sizeof (struct io_uring_sqe));
+	uring->sqArray[index] = index;
+	uring->numToSubmit++;
+	return (sqe);
+}
+
+/*
+ * queues the extraction of len bytes at data into fileName, created as
+ * baseName in dir, or from the current directory without one, waiting
+ * for a free slot if every one is in flight. The names and data must
+ * stay valid until the member completes, which releases dir.
+ */
+void queueUringJob(uring_t *uring, jobDir_t *dir, char *fileName,
+		char *baseName, char *data, size_t len) {
+	if (uring->numFreeSlots == 0)
+		reapUring(uring, true);
+	int slot = uring->freeSlots[--uring->numFreeSlots];
+	uring->names[slot] = fileName;
+	uring->dirs[slot] = dir;
+	threadStats[STAT_FILES_OPENED]++;
+	threadStats[STAT_BYTES_READ] += len;
+	threadStats[STAT_BYTES_WRITTEN] += len;
+
+	struct io_uring_sqe *sqe = getUringSqe(uring);
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = (dir != NULL) ? dir->fd : AT_FDCWD;
+	sqe->addr = (uintptr_t) baseName;
+	sqe->len = 0666;
+	sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+	sqe->file_index = slot + 1;
+	sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+	sqe->user_data = (uint64_t) slot << 2 | URING_OPEN;
+
+	if (len > 0) {
+		sqe = getUringSqe(uring);
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->fd = slot;
+		sqe->addr = (uintptr_t) data;
+		sqe->len = len;
+		sqe->off = 0;
+		sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+		sqe->user_data = (uint64_t) slot << 2 | URING_WRITE;
+	}
+
+	sqe = getUringSqe(uring);
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = slot + 1;
+	sqe->user_data = (uint64_t) slot << 2 | URING_CLOSE;
+}
+
+/*
+ * submits the queued requests and handles the completions available, or
+ * waits for at least one if isWaiting. Only the close of a member or its
+ * failed request completes, as a failure cancels the rest of the chain
+ * silently. A member that cannot be created is reported as when
+ * extracting sequentially; a failed or short write is fatal as it is for
+ * writeOrExit().
+ */
+void reapUring(uring_t *uring, bool isWaiting) {
+	__atomic_store_n(uring->sqTail, *uring->sqTail + uring->numToSubmit,
+		__ATOMIC_RELEASE);
+	unsigned numToSubmit = uring->numToSubmit;
+	uring->numToSubmit = 0;
+	while (1) {
+		int ret = syscall(__NR_io_uring_enter, uring->fd, numToSubmit,
+					isWaiting ? 1 : 0, isWaiting ? IORING_ENTER_GETEVENTS : 0,
+					NULL, 0);
+		if (ret >= 0)
+			break;
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			exit(EXIT_FAILURE);
+	}
+
+	unsigned head = *uring->cqHead;
+	unsigned tail = __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cqMask];
+		int slot = cqe->user_data >> 2;
+		int request = cqe->user_data & 3;
+		if (request == URING_WRITE)
+			exit(EXIT_FAILURE);
+		if (request == URING_OPEN)
+			printf("Error creating the file: %s\n", uring->names[slot]);
+		releaseJobDir(uring->dirs[slot]);
+		uring->freeSlots[uring->numFreeSlots++] = slot;
+	}
+	__atomic_store_n(uring->cqHead, head, __ATOMIC_RELEASE);
+}
+
+/*
+ * waits until every queued member is extracted.
+ */
+void waitUring(uring_t *uring) {
+	while (uring->numFreeSlots < uring->queueDepth)
+		reapUring(uring, true);
+}
+
+/*
+ * stats and opens a file to add to an archive and builds its header.
+ * Directories, named with a trailing slash by the walker, get a header
+ * of their own. Files up to CREATE_INLINE_BYTES are read and closed;
+ * larger ones are left open for the writer to copy. With archived, a
+ * file no more recent than the member of its name is left out.
+ */
+void prepareItem(createItem_t *item, char *fileName, memberTable_t *archived,
+		int64_t *archivedMtimes) {
+	item->name = fileName;
+	item->fd = -1;
+	item->data = NULL;
+	item->size = 0;
+	item->bytesRead = 0;
+	item->extended = NULL;
+	item->extendedSize = 0;
+	enterPhase(PHASE_COPY);
+
+	/* a FIFO is not opened for reading, only found to be one */
+	bool isDirectory = (fileName[strlen(fileName) - 1] == '/');
+	int fd = -1;
+	struct stat st;
+	int result;
+	if (isDirectory)
+		result = stat(fileName, &st);
+	else {
+		fd = open(fileName, O_RDONLY | O_NONBLOCK);
+		threadStats[STAT_FILES_OPENED]++;
+		result = (fd == -1) ? -1 : fstat(fd, &st);
+	}
+	if (result == -1) {
+		item->error = errno;
+		if (fd != -1)
+			close(fd);
+		item->status = ITEM_NOT_FOUND;
+		return;
+	}
+	if ((isDirectory) ? !S_ISDIR(st.st_mode) : !S_ISREG(st.st_mode)) {
+		if (fd != -1)
+			close(fd);
+		item->status = ITEM_UNSUPPORTED;
+		return;
+	}
+	if (archived != NULL) {
+		member_t *member = findMember(archived, fileName);
+		if (member != NULL &&
+			st.st_mtime <= archivedMtimes[member - archived->members]) {
+			if (fd != -1)
+				close(fd);
+			item->status = ITEM_UNCHANGED;
+			return;
+		}
+	}
+
+	header_t *header = &item->header;
+	if (!initHeader(header, fileName, st.st_mode & 07777,
+			(isDirectory) ? 0 : st.st_size, st.st_mtime))
+		addPaxName(item, fileName, st.st_mtime);
+	if (isDirectory)
+		header->typeflag = DIRTYPE;
+	snprintf(header->uid, sizeof (header->uid), "%07o",
+		(unsigned int) (st.st_uid & 07777777));
+	snprintf(header->gid, sizeof (header->gid), "%07o",
+		(unsigned int) (st.st_gid & 07777777));
+
+	char buf[1024];
+	if (st.st_uid != cachedUid) {
+		struct passwd pw, *pwResult = NULL;
+		cachedUid = st.st_uid;
+		memset(cachedUname, 0, sizeof (cachedUname));
+		if (getpwuid_r(st.st_uid, &pw, buf, sizeof (buf), &pwResult) == 0 &&
+			pwResult != NULL)
+			strncpy(cachedUname, pw.pw_name, sizeof (cachedUname) - 1);
+	}
+	if (st.st_gid != cachedGid) {
+		struct group gr, *grResult = NULL;
+		cachedGid = st.st_gid;
+		memset(cachedGname, 0, sizeof (cachedGname));
+		if (getgrgid_r(st.st_gid, &gr, buf, sizeof (buf), &grResult) == 0 &&
+			grResult != NULL)
+			strncpy(cachedGname, gr.gr_name, sizeof (cachedGname) - 1);
+	}
+	memcpy(header->uname, cachedUname, sizeof (header->uname));
+	memcpy(header->gname, cachedGname, sizeof (header->gname));
+	setChecksum(header);
+
+	item->status = ITEM_READY;
+	if (isDirectory)
+		return;
+	item->size = st.st_size;
+	if (item->size <= CREATE_INLINE_BYTES) {
+		if (item->size > 0) {
+			item->data = xmalloc(item->size);
+			while (item->bytesRead < item->size) {
+				ssize_t bytesRead = pread(fd, item->data + item->bytesRead,
+									item->size - item->bytesRead, item->bytesRead);
+				if (bytesRead <= 0)
+					break;
+				item->bytesRead += bytesRead;
+				threadStats[STAT_BYTES_READ] += bytesRead;
+			}
+		}
+		close(fd);
+	} else
+		item->fd = fd;
+}
+
+/*
+ * gives the member of item a pax extended header holding name, which
+ * does not fit in its ustar header.
+ */
+void addPaxName(createItem_t *item, char *name, int64_t mtime) {
+	/* a record is "LEN path=NAME\n", LEN counting its own digits */
+	size_t len = strlen(name) + sizeof (" path=\n") - 1;
+	size_t digits = 1;
+	for (size_t power = 10; len + digits >= power; power *= 10)
+		digits++;
+	size_t recordLen = len + digits;
+
+	item->extendedSize = BLOCKSIZE_BYTES + roundUpToBlock(recordLen);
+	item->extended = xmalloc(item->extendedSize + 1);
+	memset(item->extended, 0, item->extendedSize);
+	header_t *header = (header_t *) item->extended;
+	initHeader(header, PAX_HEADER_NAME, 0644, recordLen, mtime);
+	header->typeflag = XHDTYPE;
+	memcpy(header->magic, POSIX_MAGIC, sizeof (header->magic)
+		+ sizeof (header->version));
+	setChecksum(header);
+	snprintf(item->extended + BLOCKSIZE_BYTES, recordLen + 1, "%zu path=%s\n",
+		recordLen, name);
+	memcpy(item->header.magic, POSIX_MAGIC, sizeof (item->header.magic)
+		+ sizeof (item->header.version));
+}
+
+void *createReader(void *arg) {
+	createPipeline_t *pipeline = arg;
+	threadTotals = pipeline->totals;
+
+	pthread_mutex_lock(&pipeline->lock);
+	while (1) {
+		while ((pipeline->nextToRead == pipeline->numFiles)
+				? !pipeline->isListed
+				: pipeline->nextToRead >= pipeline->nextToWrite + CREATE_WINDOW)
+			pthread_cond_wait(&pipeline->windowOpen, &pipeline->lock);
+		if (pipeline->nextToRead == pipeline->numFiles)
+			break;
+		size_t i = pipeline->nextToRead++;
+		char *fileName = pipeline->fileNames[i];
+		pthread_mutex_unlock(&pipeline->lock);
+
+		createItem_t item;
+		prepareItem(&item, fileName, pipeline->archived,
+			pipeline->archivedMtimes);
+
+		enterPhase(PHASE_OTHER);
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->items[i % CREATE_WINDOW] = item;
+		pthread_cond_broadcast(&pipeline->itemReady);
+	}
+	pthread_mutex_unlock(&pipeline->lock);
+	mergeThreadStats();
+	return (NULL);
+}
+
+/*
+ * lists the files to add for the readers: the names given and, depth
+ * first, the whole tree under those that are directories, every
+ * directory before its entries. Directory names get a trailing slash.
+ * Symbolic links are not followed.
+ */
+void *createWalker(void *arg) {
+	createPipeline_t *pipeline = arg;
+	threadTotals = pipeline->totals;
+	for (int i = 0; i < pipeline->numArgs; i++) {
+		char *name = pipeline->args[i];
+		struct stat st;
+		if (lstat(name, &st) == -1 || !S_ISDIR(st.st_mode)) {
+			listFile(pipeline, name);
+			continue;
+		}
+		size_t len = strlen(name);
+		while (len > 1 && name[len - 1] == '/')
+			len--;
+		char *dirName = arenaAlloc(pipeline->arena, len + 2);
+		memcpy(dirName, name, len);
+		if (dirName[len - 1] != '/')
+			dirName[len++] = '/';
+		dirName[len] = '\0';
+		listFile(pipeline, dirName);
+		walkDirectory(pipeline, dirName);
+	}
+
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->isListed = true;
+	pthread_cond_broadcast(&pipeline->windowOpen);
+	pthread_cond_broadcast(&pipeline->itemReady);
+	pthread_mutex_unlock(&pipeline->lock);
+	mergeThreadStats();
+	return (NULL);
+}
+
+/*
+ * lists the entries of dirName, which ends in a slash, and walks those
+ * that are directories as they come.
+ */
+void walkDirectory(createPipeline_t *pipeline, char *dirName) {
+	DIR *dir = opendir(dirName);
+	if (dir == NULL) {
+		fprintf(stderr, MSG_PREFFIX " %.*s: Cannot open: %s\n",
+			(int) strlen(dirName) - 1, dirName, strerror(errno));
+		pipeline->walkStatus = ERROR_CODE_TWO;
+		return;
+	}
+	threadStats[STAT_FILES_OPENED]++;
+	size_t dirLen = strlen(dirName);
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+			continue;
+		bool isDirectory = (entry->d_type == DT_DIR);
+		struct stat st;
+		if (entry->d_type == DT_UNKNOWN &&
+			fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+			isDirectory = S_ISDIR(st.st_mode);
+
+		size_t len = strlen(entry->d_name);
+		char *path = arenaAlloc(pipeline->arena, dirLen + len + 2);
+		memcpy(path, dirName, dirLen);
+		memcpy(path + dirLen, entry->d_name, len);
+		path[dirLen + len] = '/';
+		path[dirLen + len + isDirectory] = '\0';
+		listFile(pipeline, path);
+		if (isDirectory)
+			walkDirectory(pipeline, path);
+	}
+	closedir(dir);
+}
+
+void listFile(createPipeline_t *pipeline, char *fileName) {
+	pthread_mutex_lock(&pipeline->lock);
+	if (pipeline->numFiles == pipeline->capacity) {
+		pipeline->capacity = (pipeline->capacity == 0) ? 1024
+							: pipeline->capacity * 2;
+		pipeline->fileNames = realloc(pipeline->fileNames,
+								pipeline->capacity * sizeof (char *));
+		if (pipeline->fileNames == NULL)
+			err(1, "failed to allocate %zu file names", pipeline->capacity);
+	}
+	pipeline->fileNames[pipeline->numFiles++] = fileName;
+	pthread_cond_broadcast(&pipeline->windowOpen);
+	pthread_mutex_unlock(&pipeline->lock);
+}
+
+/*
+ * copies len bytes from the current position of fdIn to fdOut, inside
+ * the kernel if possible and through buffer otherwise. Pads with zeros if
+ * fdIn ends first.
+ */
+void copyFd(int fdIn, writer_t *writer, size_t len, char *buffer,
+		size_t bufferSize) {
+	bool isKernelCopy = (writer->compression == COMPRESS_NONE);
+	while (len > 0) {
+		ssize_t copied = -1;
+		if (isKernelCopy) {
+			copied = copy_file_range(fdIn, NULL, writer->fd, NULL, len, 0);
+			if (copied == -1 && errno != EIO && errno != ENOSPC &&
+				errno != EDQUOT) {
+				isKernelCopy = false;
+				continue;
+			}
+			if (copied == -1)
+				exit(EXIT_FAILURE);
+			threadStats[STAT_BYTES_WRITTEN] += copied;
+		} else {
+			copied = read(fdIn, buffer, (len < bufferSize) ? len : bufferSize);
+			if (copied == -1)
+				exit(EXIT_FAILURE);
+			writeArchive(writer, buffer, copied);
+		}
+		threadStats[STAT_BYTES_READ] += copied;
+
+		if (copied == 0) {
+			memset(buffer, 0, bufferSize);
+			while (len > 0) {
+				size_t padding = (len < bufferSize) ? len : bufferSize;
+				writeArchive(writer, buffer, padding);
+				len -= padding;
+			}
+			break;
+		}
+		len -= copied;
+	}
+}
+
+/*
+ * writes a new archive with the given files and directory trees, read by
+ * numReaders threads and written in order, as a seekable gzip archive if
+ * compression is COMPRESS_GZIP. With an appendOffset of 0 or more the
+ * files are instead written into the existing archive from that offset,
+ * followed by a new end, and the archive is synced once; archived and
+ * archivedMtimes then leave out the files not more recent than their
+ * member, see createPipeline_t. Files that cannot be added are reported
+ * and skipped. Returns 0, or ERROR_CODE_TWO if any file was skipped.
+ */
+int createArchive(char *tarArchiveName, char **fileNames, int numFiles,
+		int numReaders, bool verbose, int compression, off_t appendOffset,
+		memberTable_t *archived, int64_t *archivedMtimes) {
+	int fdOut = -1;
+	if (appendOffset < 0)
+		fdOut = createFile(tarArchiveName);
+	else {
+		fdOut = open(tarArchiveName, O_WRONLY);
+		threadStats[STAT_FILES_OPENED]++;
+		if (fdOut != -1 && lseek(fdOut, appendOffset, SEEK_SET) == -1)
+			err(1, "failed to seek in %s", tarArchiveName);
+	}
+	if (fdOut == -1) {
+		printf(MSG_PREFFIX " %s: Cannot open\n", tarArchiveName);
+		return (ERROR_CODE_TWO);
+	}
+	writer_t *writer = createWriter(fdOut, compression);
+	enterPhase(PHASE_COPY);
+
+	createPipeline_t *pipeline = xmalloc(sizeof (createPipeline_t));
+	pipeline->args = fileNames;
+	pipeline->numArgs = numFiles;
+	pipeline->fileNames = NULL;
+	pipeline->numFiles = 0;
+	pipeline->capacity = 0;
+	pipeline->isListed = false;
+	pipeline->walkStatus = 0;
+	pipeline->arena = createArena();
+	pipeline->totals = threadTotals;
+	pipeline->archived = archived;
+	pipeline->archivedMtimes = archivedMtimes;
+	pipeline->nextToRead = 0;
+	pipeline->nextToWrite = 0;
+	for (int i = 0; i < CREATE_WINDOW; i++)
+		pipeline->items[i].status = ITEM_PENDING;
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->itemReady, NULL);
+	pthread_cond_init(&pipeline->windowOpen, NULL);
+
+	pthread_t walker;
+	if (pthread_create(&walker, NULL, createWalker, pipeline) != 0)
+		errx(1, "failed to create walker thread");
+	pthread_t *threads = xmalloc(numReaders * sizeof (pthread_t));
+	for (int i = 0; i < numReaders; i++) {
+		if (pthread_create(&threads[i], NULL, createReader, pipeline) != 0)
+			errx(1, "failed to create reader thread");
+	}
+
+	char *batch = xmalloc(CREATE_BATCH_BYTES);
+	size_t batchUsed = 0;
+	size_t archiveSize = (appendOffset < 0) ? 0 : appendOffset;
+	int status = 0;
+
+	for (size_t i = 0; ; i++) {
+		createItem_t *item = &pipeline->items[i % CREATE_WINDOW];
+		pthread_mutex_lock(&pipeline->lock);
+		while ((i < pipeline->numFiles) ? item->status == ITEM_PENDING
+				: !pipeline->isListed)
+			pthread_cond_wait(&pipeline->itemReady, &pipeline->lock);
+		bool isLast = (i == pipeline->numFiles);
+		pthread_mutex_unlock(&pipeline->lock);
+		if (isLast)
+			break;
+
+		if (item->status == ITEM_NOT_FOUND) {
+			fprintf(stderr, MSG_PREFFIX " %s: Cannot %s: %s\n", item->name,
+				(item->error == ENOENT) ? "stat" : "open",
+				strerror(item->error));
+			status = ERROR_CODE_TWO;
+		} else if (item->status == ITEM_UNSUPPORTED) {
+			fprintf(stderr, MSG_PREFFIX " %s: Unsupported file type;"
+					" not dumped\n", item->name);
+			status = ERROR_CODE_TWO;
+		} else if (item->status == ITEM_READY) {
+			if (verbose)
+				printf("%s\n", item->name);
+
+			if (item->extended != NULL) {
+				if (batchUsed + item->extendedSize > CREATE_BATCH_BYTES) {
+					writeArchive(writer, batch, batchUsed);
+					batchUsed = 0;
+				}
+				if (item->extendedSize > CREATE_BATCH_BYTES)
+					writeArchive(writer, item->extended, item->extendedSize);
+				else {
+					memcpy(batch + batchUsed, item->extended,
+						item->extendedSize);
+					batchUsed += item->extendedSize;
+				}
+				archiveSize += item->extendedSize;
+				free(item->extended);
+			}
+
+			size_t paddedSize = roundUpToBlock(item->size);
+			if (batchUsed + BLOCKSIZE_BYTES > CREATE_BATCH_BYTES) {
+				writeArchive(writer, batch, batchUsed);
+				batchUsed = 0;
+			}
+			memcpy(batch + batchUsed, item->header.block, BLOCKSIZE_BYTES);
+			batchUsed += BLOCKSIZE_BYTES;
+
+			if (item->fd == -1) {
+				if (batchUsed + paddedSize > CREATE_BATCH_BYTES) {
+					writeArchive(writer, batch, batchUsed);
+					batchUsed = 0;
+				}
+				if (item->bytesRead > 0)
+					memcpy(batch + batchUsed, item->data, item->bytesRead);
+				memset(batch + batchUsed + item->bytesRead, 0,
+					paddedSize - item->bytesRead);
+				batchUsed += paddedSize;
+				free(item->data);
+			} else {
+				writeArchive(writer, batch, batchUsed);
+				batchUsed = 0;
+				copyFd(item->fd, writer, item->size, batch, CREATE_BATCH_BYTES);
+				close(item->fd);
+				memset(batch, 0, paddedSize - item->size);
+				batchUsed = paddedSize - item->size;
+			}
+			archiveSize += BLOCKSIZE_BYTES + paddedSize;
+		}
+
+		pthread_mutex_lock(&pipeline->lock);
+		item->status = ITEM_PENDING;
+		pipeline->nextToWrite++;
+		pthread_cond_broadcast(&pipeline->windowOpen);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+
+	pthread_join(walker, NULL);
+	for (int i = 0; i < numReaders; i++)
+		pthread_join(threads[i], NULL);
+	if (pipeline->walkStatus != 0)
+		status = pipeline->walkStatus;
+
+	size_t trailer = countTrailerBytes(archiveSize);
+	if (batchUsed + trailer > CREATE_BATCH_BYTES) {
+		writeArchive(writer, batch, batchUsed);
+		batchUsed = 0;
+	}
+	memset(batch + batchUsed, 0, trailer);
+	writeArchive(writer, batch, batchUsed + trailer);
+	if (appendOffset >= 0) {
+		/* the old end may have been longer than the new one */
+		if (ftruncate(fdOut, archiveSize + trailer) == -1 ||
+			fsync(fdOut) == -1)
+			err(1, "failed to update %s", tarArchiveName);
+	}
+	closeWriter(writer);
+
+	pthread_mutex_destroy(&pipeline->lock);
+	pthread_cond_destroy(&pipeline->itemReady);
+	pthread_cond_destroy(&pipeline->windowOpen);
+	releaseArena(pipeline->arena);
+	free(pipeline->arena);
+	free(pipeline->fileNames);
+	free(batch);
+	free(threads);
+	free(pipeline);
+	return (status);
+}
+
+/*
+ * appends files and directory trees to an existing archive in place.
+ * The headers are scanned up to the end of the archive, the members are
+ * written over its zero blocks and the rest is left untouched. With
+ * isUpdate, a file is only added if the archive holds no member of that
+ * name at least as recent. An archive that does not exist is created.
+ * Returns as createArchive().
+ */
+int appendArchive(char *tarArchiveName, char **fileNames, int numFiles,
+		int numReaders, bool verbose, bool isUpdate) {
+	archive_t *archive = openArchive(tarArchiveName, COMPRESS_AUTO, IO_CACHE);
+	if (archive == NULL)
+		return (createArchive(tarArchiveName, fileNames, numFiles,
+					numReaders, verbose, COMPRESS_NONE, -1, NULL, NULL));
+	if (archive->reader == READER_STREAM ||
+		archive->reader == READER_SEEKABLE) {
+		printf(MSG_PREFFIX " Cannot update compressed archives\n");
+		printf(MSG_PREFFIX " Error is not recoverable: exiting now\n");
+		exit(ERROR_CODE_TWO);
+	}
+
+	/* latest mtime in the archive of every member name; the directory
+	 * trees given are only walked when writing */
+	arena_t *arena = createArena();
+	memberTable_t *archived = NULL;
+	int64_t *mtimes = NULL;
+	size_t mtimesCapacity = 0;
+	if (isUpdate)
+		archived = createMemberTable(arena);
+
+	iterator_t iterator;
+	initIterator(&iterator, archive);
+	off_t offset = 0;
+	int status;
+	while ((status = nextMember(&iterator)) == TAR_OK) {
+		if (isUpdate) {
+			int64_t mtime = parseNumeric(iterator.header->mtime,
+								sizeof (iterator.header->mtime));
+			member_t *member = findMember(archived, iterator.name);
+			if (member == NULL) {
+				member = addMember(archived, iterator.name, NULL);
+				if (archived->capacity > mtimesCapacity) {
+					mtimesCapacity = archived->capacity;
+					mtimes = realloc(mtimes, mtimesCapacity * sizeof (int64_t));
+					if (mtimes == NULL)
+						err(1, "failed to allocate %zu mtimes", mtimesCapacity);
+				}
+				mtimes[member - archived->members] = mtime;
+			}
+			size_t memberNumber = member - archived->members;
+			if (mtime > mtimes[memberNumber])
+				mtimes[memberNumber] = mtime;
+		}
+
+		offset += archive->numHeaderBlocks * BLOCKSIZE_BYTES
+				+ iterator.dataLeft;
+		if (skipMember(&iterator) != TAR_OK)
+			exitUnexpectedEof();
+	}
+	if (status != TAR_END)
+		exitArchiveError(&iterator, status);
+	if (archive->numSkippedHeaders > 0) {
+		fprintf(stderr, MSG_PREFFIX " Exiting with failure status due to"
+				" previous errors\n");
+		exit(ERROR_CODE_TWO);
+	}
+	closeArchive(archive);
+
+	status = createArchive(tarArchiveName, fileNames, numFiles, numReaders,
+				verbose, COMPRESS_NONE, offset, archived, mtimes);
+	free(mtimes);
+	if (archived != NULL)
+		freeMemberTable(archived);
+	releaseArena(arena);
+	free(arena);
+	return (status);
+}
+
+/*
+ * fills header for a regular file owned by uid and gid 0, leaving the
+ * checksum to setChecksum(). Returns false if name does not fit, see
+ * setHeaderName().
+ */
+bool initHeader(header_t *header, char *name, unsigned int mode,
+		uint64_t size, uint64_t mtime) {
+	memset(header->block, 0, BLOCKSIZE_BYTES);
+	snprintf(header->mode, sizeof (header->mode), "%07o", mode);
+	snprintf(header->uid, sizeof (header->uid), "%07o", 0);
+	snprintf(header->gid, sizeof (header->gid), "%07o", 0);
+	putNumeric(header->size, sizeof (header->size), size);
+	putNumeric(header->mtime, sizeof (header->mtime), mtime);
+	header->typeflag = REGTYPE;
+	memcpy(header->magic, TAR_MAGIC, sizeof (header->magic)
+		+ sizeof (header->version));
+	return (setHeaderName(header, name));
+}
+
+/*
+ * stores name in header: in the name field if it fits, and otherwise
+ * split at a slash into the prefix and name fields of a POSIX ustar
+ * header, as old GNU headers have no prefix. Returns false if it cannot
+ * be split, leaving its first characters in the name field for a pax
+ * path record to override.
+ */
+bool setHeaderName(header_t *header, char *name) {
+	size_t len = strlen(name);
+	if (len < SIZE_NAME_MAX) {
+		memcpy(header->name, name, len + 1);
+		return (true);
+	}
+
+	/* the first slash leaving a name part that fits */
+	size_t split = (len > SIZE_NAME_MAX) ? len - SIZE_NAME_MAX - 1 : 1;
+	for (; split <= SIZE_PREFIX_MAX && split + 1 < len; split++) {
+		if (split == 0 || name[split] != '/')
+			continue;
+		memcpy(header->prefix, name, split);
+		memcpy(header->name, name + split + 1, len - split - 1);
+		memcpy(header->magic, POSIX_MAGIC, sizeof (header->magic)
+			+ sizeof (header->version));
+		return (true);
+	}
+	memcpy(header->name, name, SIZE_NAME_MAX - 1);
+	return (false);
+}
+
+void setChecksum(header_t *header) {
+	memset(header->chksum, ' ', sizeof (header->chksum));
+	snprintf(header->chksum, sizeof (header->chksum) - 1, "%06o",
+		headerChecksum(header));
+}
+
+/*
+ * returns the number of zero bytes ending an archive of archiveSize
+ * bytes: two zero blocks, padded to a whole record.
+ */
+size_t countTrailerBytes(size_t archiveSize) {
+	size_t endSize = roundUpToBlock(archiveSize + 2 * BLOCKSIZE_BYTES);
+	if (endSize % RECORDSIZE_BYTES != 0)
+		endSize += RECORDSIZE_BYTES - endSize % RECORDSIZE_BYTES;
+	return (endSize - archiveSize);
+}
+
+/*
+ * parses the argument of --generate, COUNT:MIN-MAX:NAMELEN, where sizes
+ * may end in K, M or G, e.g. 1000000:0-4K:16 for a million tiny files.
+ * Exits if it is malformed.
+ */
+void parseGenerateSpec(char *arg, generateSpec_t *spec) {
+	memset(spec, 0, sizeof (generateSpec_t));
+	char *end = arg;
+	bool isValid = (*arg >= '0' && *arg <= '9');
+	if (isValid) {
+		spec->numMembers = strtoull(arg, &end, 10);
+		isValid = (*end == ':');
+	}
+	if (isValid) {
+		spec->minSize = parseByteCount(end + 1, &end);
+		isValid = (*end == '-');
+	}
+	if (isValid) {
+		spec->maxSize = parseByteCount(end + 1, &end);
+		isValid = (*end == ':' && end[1] >= '0' && end[1] <= '9');
+	}
+	if (isValid) {
+		spec->nameLen = strtol(end + 1, &end, 10);
+		isValid = (*end == '\0');
+	}
+
+	/* names are the member number, padded to nameLen */
+	size_t numDigits = 1;
+	for (size_t n = 10; n < spec->numMembers; n *= 10)
+		numDigits++;
+	if (!isValid || spec->numMembers == 0 || spec->minSize > spec->maxSize ||
+		spec->nameLen >= SIZE_NAME_MAX || (size_t) spec->nameLen < numDigits) {
+		printf(MSG_PREFFIX " Invalid archive shape: %s\n"
+			"Expected COUNT:MIN-MAX:NAMELEN, with names long enough for"
+			" COUNT and shorter than %d characters\n", arg, SIZE_NAME_MAX);
+		exit(ERROR_CODE_TWO);
+	}
+}
+
+uint64_t parseByteCount(char *arg, char **end) {
+	uint64_t value = strtoull(arg, end, 10);
+	if (**end == 'K')
+		value <<= 10;
+	else if (**end == 'M')
+		value <<= 20;
+	else if (**end == 'G')
+		value <<= 30;
+	else
+		return (value);
+	(*end)++;
+	return (value);
+}
+
+/*
+ * splitmix64: the next pseudo random number of the sequence in *state.
+ */
+uint64_t nextRandom(uint64_t *state) {
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return (z ^ (z >> 31));
+}
+
+/*
+ * writes a synthetic archive of the given shape for benchmarks. Sizes
+ * are drawn by picking a power of two between those of minSize and
+ * maxSize and then a size below the next one, clamped to the range, and
+ * contents are cut from a block of random bytes, all from a fixed seed,
+ * so that a shape always yields the same archive. Returns 0, or
+ * ERROR_CODE_TWO if the archive cannot be created.
+ */
+int generateArchive(char *tarArchiveName, generateSpec_t *spec,
+		int compression) {
+	int fdOut = createFile(tarArchiveName);
+	if (fdOut == -1) {
+		printf(MSG_PREFFIX " %s: Cannot open\n", tarArchiveName);
+		return (ERROR_CODE_TWO);
+	}
+	writer_t *writer = createWriter(fdOut, compression);
+
+	uint64_t state = GENERATE_SEED;
+	char *data = xmalloc(GENERATE_DATA_BYTES);
+	for (size_t i = 0; i < GENERATE_DATA_BYTES; i += sizeof (uint64_t)) {
+		uint64_t value = nextRandom(&state);
+		memcpy(data + i, &value, sizeof (uint64_t));
+	}
+
+	int minBits = 0;
+	while (minBits < 63 && (1ULL << (minBits + 1)) <= spec->minSize)
+		minBits++;
+	int maxBits = minBits;
+	while (maxBits < 63 && (1ULL << (maxBits + 1)) <= spec->maxSize)
+		maxBits++;
+
+	char *batch = xmalloc(CREATE_BATCH_BYTES);
+	size_t batchUsed = 0;
+	size_t archiveSize = 0;
+	char name[SIZE_NAME_MAX];
+	header_t header;
+
+	for (size_t i = 0; i < spec->numMembers; i++) {
+		int bits = minBits + nextRandom(&state) % (maxBits - minBits + 1);
+		uint64_t size = (1ULL << bits) + nextRandom(&state) % (1ULL << bits);
+		if (bits == 0 && spec->minSize == 0)
+			size = nextRandom(&state) % 2;
+		if (size < spec->minSize)
+			size = spec->minSize;
+		if (size > spec->maxSize)
+			size = spec->maxSize;
+
+		snprintf(name, sizeof (name), "%0*zu", spec->nameLen, i);
+		initHeader(&header, name, 0644, size, GENERATE_MTIME);
+		setChecksum(&header);
+		if (batchUsed + BLOCKSIZE_BYTES > CREATE_BATCH_BYTES) {
+			writeArchive(writer, batch, batchUsed);
+			batchUsed = 0;
+		}
+		memcpy(batch + batchUsed, header.block, BLOCKSIZE_BYTES);
+		batchUsed += BLOCKSIZE_BYTES;
+
+		size_t paddedSize = roundUpToBlock(size);
+		size_t offset = nextRandom(&state) % GENERATE_DATA_BYTES;
+		for (size_t written = 0; written < paddedSize; ) {
+			if (batchUsed == CREATE_BATCH_BYTES) {
+				writeArchive(writer, batch, batchUsed);
+				batchUsed = 0;
+			}
+			size_t len = paddedSize - written;
+			if (len > CREATE_BATCH_BYTES - batchUsed)
+				len = CREATE_BATCH_BYTES - batchUsed;
+			if (len > GENERATE_DATA_BYTES - offset)
+				len = GENERATE_DATA_BYTES - offset;
+			if (written + len <= size)
+				memcpy(batch + batchUsed, data + offset, len);
+			else if (written < size) {
+				memcpy(batch + batchUsed, data + offset, size - written);
+				memset(batch + batchUsed + size - written, 0,
+					written + len - size);
+			} else
+				memset(batch + batchUsed, 0, len);
+			batchUsed += len;
+			written += len;
+			offset = (offset + len) % GENERATE_DATA_BYTES;
+		}
+		archiveSize += BLOCKSIZE_BYTES + paddedSize;
+	}
+
+	size_t trailer = countTrailerBytes(archiveSize);
+	if (batchUsed + trailer > CREATE_BATCH_BYTES) {
+		writeArchive(writer, batch, batchUsed);
+		batchUsed = 0;
+	}
+	memset(batch + batchUsed, 0, trailer);
+	writeArchive(writer, batch, batchUsed + trailer);
+	closeWriter(writer);
+	free(batch);
+	free(data);
+	return (0);
+}
+
+/*
+ * returns the output of a new archive on fd. Exits if compression cannot
+ * be written.
+ */
+writer_t *createWriter(int fd, int compression) {
+	writer_t *new = xmalloc(sizeof (writer_t));
+	new->fd = fd;
+	new->compression = compression;
+	new->frame = NULL;
+	new->frameUsed = 0;
+	new->output = NULL;
+	new->outputSize = 0;
+	new->frameSizes = NULL;
+	new->numFrames = 0;
+	new->capacity = 0;
+	new->encoder = NULL;
+	if (compression == COMPRESS_NONE)
+		return (new);
+
+	if (compression != COMPRESS_GZIP) {
+		printf(MSG_PREFFIX " Creating zstd archives is not supported\n");
+		exit(ERROR_CODE_TWO);
+	}
+#ifdef HAVE_ZLIB
+	z_stream *zs = xmalloc(sizeof (z_stream));
+	memset(zs, 0, sizeof (z_stream));
+	if (deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+		Z_DEFAULT_STRATEGY) != Z_OK)
+		errx(1, "failed to initialize gzip compression");
+	new->encoder = zs;
+	new->frame = xmalloc(SEEKABLE_FRAME_BYTES);
+	new->outputSize = deflateBound(zs, SEEKABLE_FRAME_BYTES);
+	new->output = xmalloc(new->outputSize);
+#else
+	printf(MSG_PREFFIX " gzip support was not compiled in\n");
+	exit(ERROR_CODE_TWO);
+#endif
+	return (new);
+}
+
+void writeArchive(writer_t *writer, char *buffer, size_t len) {
+	if (writer->compression == COMPRESS_NONE) {
+		writeOrExit(writer->fd, buffer, len);
+		return;
+	}
+	while (len > 0) {
+		size_t available = SEEKABLE_FRAME_BYTES - writer->frameUsed;
+		if (available > len)
+			available = len;
+		memcpy(writer->frame + writer->frameUsed, buffer, available);
+		writer->frameUsed += available;
+		buffer += available;
+		len -= available;
+		if (writer->frameUsed == SEEKABLE_FRAME_BYTES)
+			flushFrame(writer);
+	}
+}
+
+/*
+ * compresses the gathered data as one frame and records its sizes.
+ */
+void flushFrame(writer_t *writer) {
+	size_t compressedSize = 0;
+#ifdef HAVE_ZLIB
+	z_stream *zs = writer->encoder;
+	deflateReset(zs);
+	zs->next_in = (unsigned char *) writer->frame;
+	zs->avail_in = writer->frameUsed;
+	zs->next_out = (unsigned char *) writer->output;
+	zs->avail_out = writer->outputSize;
+	if (deflate(zs, Z_FINISH) != Z_STREAM_END)
+		errx(1, "failed to compress archive");
+	compressedSize = writer->outputSize - zs->avail_out;
+#endif
+	writeOrExit(writer->fd, writer->output, compressedSize);
+
+	if (writer->numFrames == writer->capacity) {
+		writer->capacity = (writer->capacity == 0) ? 64 : 2 * writer->capacity;
+		writer->frameSizes = realloc(writer->frameSizes,
+								2 * writer->capacity * sizeof (uint32_t));
+		if (writer->frameSizes == NULL)
+			err(1, "realloc");
+	}
+	writer->frameSizes[2 * writer->numFrames] = compressedSize;
+	writer->frameSizes[2 * writer->numFrames + 1] = writer->frameUsed;
+	writer->numFrames++;
+	writer->frameUsed = 0;
+}
+
+/*
+ * writes an empty gzip member whose extra field holds len bytes of data
+ * under subfield.
+ */
+void writeExtraMember(int fd, char *subfield, char *data, size_t len) {
+	char member[GZIP_EXTRA_HEADER_BYTES + 6];
+	memcpy(member, GZIP_EXTRA_HEADER, GZIP_EXTRA_HEADER_BYTES);
+	member[10] = (len + 4) & 0xff;
+	member[11] = (len + 4) >> 8;
+	member[12] = subfield[0];
+	member[13] = subfield[1];
+	member[14] = len & 0xff;
+	member[15] = len >> 8;
+	writeOrExit(fd, member, sizeof (member));
+	writeOrExit(fd, data, len);
+
+	/* empty final deflate block, then crc32 and size of no data */
+	char trailer[10] = { 0x03, 0x00 };
+	writeOrExit(fd, trailer, sizeof (trailer));
+}
+
+/*
+ * flushes the last frame, writes the frame table and footer of a
+ * seekable archive, and closes the output.
+ */
+void closeWriter(writer_t *writer) {
+	if (writer->compression != COMPRESS_NONE) {
+		if (writer->frameUsed > 0)
+			flushFrame(writer);
+
+		size_t tableSize = 0;
+		char *table = xmalloc(8 * SEEKABLE_TABLE_ENTRIES);
+		for (size_t i = 0; i < writer->numFrames;
+			i += SEEKABLE_TABLE_ENTRIES) {
+			size_t numEntries = writer->numFrames - i;
+			if (numEntries > SEEKABLE_TABLE_ENTRIES)
+				numEntries = SEEKABLE_TABLE_ENTRIES;
+			for (size_t j = 0; j < 2 * numEntries; j++)
+				putLe32(table + 4 * j, writer->frameSizes[2 * i + j]);
+			writeExtraMember(writer->fd, "MT", table, 8 * numEntries);
+			tableSize += GZIP_EXTRA_HEADER_BYTES + 16 + 8 * numEntries;
+		}
+		free(table);
+
+		char footer[16];
+		putLe32(footer, writer->numFrames);
+		putLe32(footer + 4, tableSize);
+		memcpy(footer + 8, SEEKABLE_MAGIC, 8);
+		writeExtraMember(writer->fd, "MF", footer, sizeof (footer));
+
+#ifdef HAVE_ZLIB
+		deflateEnd(writer->encoder);
+#endif
+	}
+	if (close(writer->fd) == -1)
+		exit(EXIT_FAILURE);
+	free(writer->encoder);
+	free(writer->frame);
+	free(writer->output);
+	free(writer->frameSizes);
+	free(writer);
+}
+
+void putLe32(char *buffer, uint32_t value) {
+	for (int i = 0; i < 4; i++)
+		buffer[i] = (value >> (8 * i)) & 0xff;
+}
+
+uint32_t getLe32(char *buffer) {
+	uint32_t value = 0;
+	for (int i = 0; i < 4; i++)
+		value |= (uint32_t) (unsigned char) buffer[i] << (8 * i);
+	return (value);
+}
+
+/*
+ * writes the len bytes of buffer to fd. Returns false, with errno set, if
+ * a write fails.
+ */
+bool writeAll(int fd, char *buffer, size_t len) {
+	threadStats[STAT_BYTES_WRITTEN] += len;
+	while (len > 0) {
+		ssize_t written = write(fd, buffer, len);
+		if (written == -1) {
+			if (errno == EINTR)
+				continue;
+			return (false);
+		}
+		buffer += written;
+		len -= written;
+	}
+	return (true);
+}
+
+void writeOrExit(int fd, char *buffer, size_t len) {
+	if (!writeAll(fd, buffer, len))
+		exit(EXIT_FAILURE);
+}
+
+/*
+ * opens an archive for reading with the page cache policy ioPolicy.
+ * Regular files are mapped whole so that walking the headers costs no
+ * syscalls; the size comes from a single fstat. Returns NULL if the file
+ * cannot be opened. A compression the tool was built without is
+ * reported by the first nextMember().
+ */
+archive_t *openArchive(char *fileName, int compression, int ioPolicy) {
+	int fd = STDIN_FILENO;
+	if (fileName == NULL || strcmp(fileName, STDIN_ARCHIVE) != 0) {
+		fd = open(fileName, O_RDONLY);
+		threadStats[STAT_FILES_OPENED]++;
+	}
+	if (fd == -1)
+		return (NULL);
+
+	archive_t *archive = xmalloc(sizeof (archive_t));
+	archive->reader = READER_STDIO;
+	archive->fd = fd;
+	archive->ioPolicy = ioPolicy;
+	archive->file = NULL;
+	archive->stream = NULL;
+	archive->seekable = NULL;
+	archive->isTruncated = false;
+	archive->error = TAR_OK;
+	archive->numSkippedHeaders = 0;
+	archive->copyMethod = COPY_FILE_RANGE;
+	archive->copyBuffer = NULL;
+	archive->map = NULL;
+	archive->size = 0;
+	archive->offset = 0;
+	archive->droppedOffset = 0;
+	archive->isDroppingBehind = false;
+	archive->memberName = NULL;
+	archive->memberSize = 0;
+	archive->numHeaderBlocks = 0;
+	archive->sparse = NULL;
+	archive->sparseMap.regions = NULL;
+	archive->sparseMap.numRegions = 0;
+	archive->sparseMap.capacity = 0;
+	archive->sparseMap.realSize = 0;
+	archive->extendedData = NULL;
+	archive->extendedCapacity = 0;
+
+	struct stat st;
+	bool isRegular = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+	if (isRegular && ioPolicy != IO_CACHE)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (!isRegular) {
+		archive->reader = READER_STREAM;
+		archive->stream = openStream(fd, compression, ioPolicy);
+		return (archive);
+	}
+
+	if (compression == COMPRESS_AUTO)
+		compression = detectCompression(fd);
+	if (compression == COMPRESS_GZIP)
+		archive->seekable = openSeekable(fd, st.st_size);
+	if (archive->seekable != NULL) {
+		archive->reader = READER_SEEKABLE;
+		archive->size = archive->seekable->offsets[archive->seekable->numFrames];
+		return (archive);
+	}
+	if (compression != COMPRESS_NONE) {
+		archive->reader = READER_STREAM;
+		archive->stream = openStream(fd, compression, ioPolicy);
+		return (archive);
+	}
+
+	if (st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			archive->reader = READER_MMAP;
+			archive->map = map;
+			archive->size = st.st_size;
+			if (ioPolicy != IO_CACHE) {
+				madvise(map, st.st_size, MADV_SEQUENTIAL);
+				archive->isDroppingBehind = true;
+			}
+		}
+	}
+
+	archive->file = fdopen(fd, "r");
+	if (archive->file == NULL) {
+		closeArchive(archive);
+		return (NULL);
+	}
+	return (archive);
+}
+
+void closeArchive(archive_t *archive) {
+	if (archive->reader == READER_MMAP)
+		munmap(archive->map, archive->size);
+	free(archive->copyBuffer);
+	free(archive->sparseMap.regions);
+	free(archive->extendedData);
+	if (archive->stream != NULL)
+		closeStream(archive->stream);
+	if (archive->seekable != NULL)
+		closeSeekable(archive->seekable);
+	if (archive->file != NULL)
+		fclose(archive->file);
+	else
+		close(archive->fd);
+	free(archive);
+}
+
+/*
+ * detects the compression of a regular file from its first bytes.
+ */
+int detectCompression(int fd) {
+	char magic[4];
+	ssize_t len = pread(fd, magic, sizeof (magic), 0);
+	return (detectMagic(magic, (len > 0) ? len : 0));
+}
+
+int detectMagic(char *magic, size_t len) {
+	if (len >= 2 && memcmp(magic, GZIP_MAGIC, 2) == 0)
+		return (COMPRESS_GZIP);
+	if (len >= 4 && memcmp(magic, ZSTD_MAGIC, 4) == 0)
+		return (COMPRESS_ZSTD);
+	return (COMPRESS_NONE);
+}
+
+/*
+ * returns false if the tool was built without support for the
+ * compression.
+ */
+bool checkCompression(int compression) {
+#ifndef HAVE_ZLIB
+	if (compression == COMPRESS_GZIP)
+		return (false);
+#endif
+#ifndef HAVE_ZSTD
+	if (compression == COMPRESS_ZSTD)
+		return (false);
+#endif
+	(void) compression;
+	return (true);
+}
+
+/*
+ * starts the thread reading and decompressing fd. A compression the
+ * tool was built without ends the stream at once with
+ * TAR_ERR_COMPRESSION.
+ */
+stream_t *openStream(int fd, int compression, int ioPolicy) {
+	stream_t *new = xmalloc(sizeof (stream_t));
+	new->fd = fd;
+	new->compression = compression;
+	new->ioPolicy = ioPolicy;
+	new->error = TAR_OK;
+	new->totals = threadTotals;
+	for (int i = 0; i < STREAM_BUFFERS; i++) {
+		new->buffers[i] = xmalloc(STREAM_BUFFER_BYTES);
+		new->lengths[i] = 0;
+	}
+	new->numFilled = 0;
+	new->producerIndex = 0;
+	new->consumerIndex = 0;
+	new->consumerOffset = 0;
+	new->inputOffset = 0;
+	new->droppedOffset = 0;
+	new->isEnded = false;
+	new->isStopping = false;
+	pthread_mutex_init(&new->lock, NULL);
+	pthread_cond_init(&new->filled, NULL);
+	pthread_cond_init(&new->drained, NULL);
+	if (pthread_create(&new->thread, NULL, streamProducer, new) != 0)
+		errx(1, "failed to create decompression thread");
+	return (new);
+}
+
+void closeStream(stream_t *stream) {
+	pthread_mutex_lock(&stream->lock);
+	stream->isStopping = true;
+	pthread_cond_broadcast(&stream->drained);
+	pthread_mutex_unlock(&stream->lock);
+	pthread_join(stream->thread, NULL);
+
+	pthread_mutex_destroy(&stream->lock);
+	pthread_cond_destroy(&stream->filled);
+	pthread_cond_destroy(&stream->drained);
+	for (int i = 0; i < STREAM_BUFFERS; i++)
+		free(stream->buffers[i]);
+	free(stream);
+}
+
+/*
+ * counts bytesRead more bytes read from the file of a stream and, with
+ * an I/O policy other than IO_CACHE, drops from the page cache what was
+ * read more than a window ago. Fails quietly on pipes.
+ */
+void dropStreamInput(stream_t *stream, size_t bytesRead) {
+	stream->inputOffset += bytesRead;
+	if (stream->ioPolicy == IO_CACHE ||
+		stream->inputOffset < stream->droppedOffset + 2 * IO_WINDOW_BYTES)
+		return;
+	size_t end = stream->inputOffset - IO_WINDOW_BYTES;
+	end -= end % IO_WINDOW_BYTES;
+	posix_fadvise(stream->fd, stream->droppedOffset,
+		end - stream->droppedOffset, POSIX_FADV_DONTNEED);
+	stream->droppedOffset = end;
+}
+
+void *streamProducer(void *arg) {
+	stream_t *stream = arg;
+	threadTotals = stream->totals;
+	char *input = xmalloc(STREAM_BUFFER_BYTES);
+	size_t inputStart = 0;
+	size_t inputEnd = 0;
+	bool isEnded = false;
+	void *decoder = NULL;
+
+	/* the magic numbers are 4 bytes at most */
+	if (stream->compression == COMPRESS_AUTO) {
+		while (inputEnd < 4) {
+			ssize_t bytesRead = read(stream->fd, input + inputEnd,
+									STREAM_BUFFER_BYTES - inputEnd);
+			if (bytesRead == -1 && errno == EINTR)
+				continue;
+			if (bytesRead == -1) {
+				stream->error = TAR_ERR_IO;
+				break;
+			}
+			if (bytesRead == 0)
+				break;
+			inputEnd += bytesRead;
+			dropStreamInput(stream, bytesRead);
+		}
+		stream->compression = detectMagic(input, inputEnd);
+	}
+	if (stream->error == TAR_OK && !checkCompression(stream->compression))
+		stream->error = TAR_ERR_COMPRESSION;
+	if (stream->error != TAR_OK) {
+		pthread_mutex_lock(&stream->lock);
+		stream->isEnded = true;
+		pthread_cond_broadcast(&stream->filled);
+		pthread_mutex_unlock(&stream->lock);
+		free(input);
+		mergeThreadStats();
+		return (NULL);
+	}
+
+#ifdef HAVE_ZLIB
+	z_stream zs;
+	if (stream->compression == COMPRESS_GZIP) {
+		memset(&zs, 0, sizeof (zs));
+		if (inflateInit2(&zs, 15 + 32) != Z_OK)
+			errx(1, "failed to initialize gzip decompression");
+		decoder = &zs;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (stream->compression == COMPRESS_ZSTD) {
+		decoder = ZSTD_createDStream();
+		if (decoder == NULL)
+			errx(1, "failed to initialize zstd decompression");
+		ZSTD_initDStream(decoder);
+	}
+#endif
+
+	while (!isEnded) {
+		pthread_mutex_lock(&stream->lock);
+		while (stream->numFilled == STREAM_BUFFERS && !stream->isStopping)
+			pthread_cond_wait(&stream->drained, &stream->lock);
+		if (stream->isStopping) {
+			pthread_mutex_unlock(&stream->lock);
+			break;
+		}
+		char *buffer = stream->buffers[stream->producerIndex];
+		pthread_mutex_unlock(&stream->lock);
+
+		size_t len = fillStreamBuffer(stream, buffer, decoder, input,
+						&inputStart, &inputEnd, &isEnded);
+
+		pthread_mutex_lock(&stream->lock);
+		stream->lengths[stream->producerIndex] = len;
+		stream->producerIndex = (stream->producerIndex + 1) % STREAM_BUFFERS;
+		stream->numFilled++;
+		stream->isEnded = isEnded;
+		pthread_cond_broadcast(&stream->filled);
+		pthread_mutex_unlock(&stream->lock);
+	}
+
+#ifdef HAVE_ZLIB
+	if (stream->compression == COMPRESS_GZIP)
+		inflateEnd(&zs);
+#endif
+#ifdef HAVE_ZSTD
+	if (stream->compression == COMPRESS_ZSTD)
+		ZSTD_freeDStream(decoder);
+#endif
+	free(input);
+	mergeThreadStats();
+	return (NULL);
+}
+
+/*
+ * fills buffer with up to STREAM_BUFFER_BYTES of decompressed data,
+ * reading compressed input into input[inputStart..inputEnd) as needed.
+ * Sets *isEnded at the end of the input, and with the error of the
+ * stream on a read error or corrupt data.
+ */
+size_t fillStreamBuffer(stream_t *stream, char *buffer, void *decoder,
+		char *input, size_t *inputStart, size_t *inputEnd, bool *isEnded) {
+	size_t len = 0;
+	(void) decoder;
+	while (len < STREAM_BUFFER_BYTES) {
+		if (stream->compression == COMPRESS_NONE && *inputStart < *inputEnd) {
+			size_t available = *inputEnd - *inputStart;
+			if (available > STREAM_BUFFER_BYTES - len)
+				available = STREAM_BUFFER_BYTES - len;
+			memcpy(buffer + len, input + *inputStart, available);
+			*inputStart += available;
+			len += available;
+			continue;
+		}
+		if (stream->compression == COMPRESS_NONE) {
+			ssize_t bytesRead = read(stream->fd, buffer + len,
+									STREAM_BUFFER_BYTES - len);
+			if (bytesRead == -1 && errno == EINTR)
+				continue;
+			if (bytesRead == -1)
+				stream->error = TAR_ERR_IO;
+			if (bytesRead <= 0) {
+				*isEnded = true;
+				break;
+			}
+			len += bytesRead;
+			dropStreamInput(stream, bytesRead);
+			continue;
+		}
+
+		if (*inputStart == *inputEnd) {
+			ssize_t bytesRead = read(stream->fd, input, STREAM_BUFFER_BYTES);
+			if (bytesRead == -1 && errno == EINTR)
+				continue;
+			if (bytesRead == -1)
+				stream->error = TAR_ERR_IO;
+			if (bytesRead <= 0) {
+				*isEnded = true;
+				break;
+			}
+			*inputStart = 0;
+			*inputEnd = bytesRead;
+			dropStreamInput(stream, bytesRead);
+		}
+
+#ifdef HAVE_ZLIB
+		if (stream->compression == COMPRESS_GZIP) {
+			z_stream *zs = decoder;
+			zs->next_in = (unsigned char *) input + *inputStart;
+			zs->avail_in = *inputEnd - *inputStart;
+			zs->next_out = (unsigned char *) buffer + len;
+			zs->avail_out = STREAM_BUFFER_BYTES - len;
+			int ret = inflate(zs, Z_NO_FLUSH);
+			len = STREAM_BUFFER_BYTES - zs->avail_out;
+			*inputStart = *inputEnd - zs->avail_in;
+			if (ret == Z_STREAM_END)
+				inflateReset(zs);
+			else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+				stream->error = TAR_ERR_CORRUPT;
+				*isEnded = true;
+				break;
+			}
+		}
+#endif
+#ifdef HAVE_ZSTD
+		if (stream->compression == COMPRESS_ZSTD) {
+			ZSTD_inBuffer in = { input, *inputEnd, *inputStart };
+			ZSTD_outBuffer out = { buffer, STREAM_BUFFER_BYTES, len };
+			size_t ret = ZSTD_decompressStream(decoder, &out, &in);
+			len = out.pos;
+			*inputStart = in.pos;
+			if (ZSTD_isError(ret)) {
+				stream->error = TAR_ERR_CORRUPT;
+				*isEnded = true;
+				break;
+			}
+		}
+#endif
+	}
+	return (len);
+}
+
+/*
+ * waits for decompressed data and points *data at the contiguous bytes
+ * available in the current buffer. Returns 0 at the end of the stream.
+ */
+size_t peekStream(stream_t *stream, char **data) {
+	pthread_mutex_lock(&stream->lock);
+	while (1) {
+		while (stream->numFilled == 0 && !stream->isEnded)
+			pthread_cond_wait(&stream->filled, &stream->lock);
+		if (stream->numFilled == 0) {
+			pthread_mutex_unlock(&stream->lock);
+			return (0);
+		}
+		size_t available = stream->lengths[stream->consumerIndex]
+							- stream->consumerOffset;
+		if (available > 0) {
+			*data = stream->buffers[stream->consumerIndex]
+					+ stream->consumerOffset;
+			pthread_mutex_unlock(&stream->lock);
+			return (available);
+		}
+		stream->consumerIndex = (stream->consumerIndex + 1) % STREAM_BUFFERS;
+		stream->consumerOffset = 0;
+		stream->numFilled--;
+		pthread_cond_broadcast(&stream->drained);
+	}
+}
+
+void consumeStream(stream_t *stream, size_t len) {
+	stream->consumerOffset += len;
+}
+
+/*
+ * copies up to len bytes of the stream into buffer, or only skips them
+ * if buffer is NULL. Returns less than len only at the end of the stream.
+ */
+size_t readStream(stream_t *stream, char *buffer, size_t len) {
+	size_t total = 0;
+	while (total < len) {
+		char *data;
+		size_t available = peekStream(stream, &data);
+		if (available == 0)
+			break;
+		if (available > len - total)
+			available = len - total;
+		if (buffer != NULL)
+			memcpy(buffer + total, data, available);
+		consumeStream(stream, available);
+		total += available;
+	}
+	return (total);
+}
+
+/*
+ * maps fd and reads the frame table of a seekable gzip archive. Returns
+ * NULL if the file is not one, so that it is read as a plain stream; a
+ * footer counting more frames than its table has room for is checked
+ * before anything is allocated for them.
+ */
+seekable_t *openSeekable(int fd, size_t fileSize) {
+#ifndef HAVE_ZLIB
+	(void) fd;
+	(void) fileSize;
+	return (NULL);
+#else
+	if (fileSize < SEEKABLE_FOOTER_BYTES)
+		return (NULL);
+	char *map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return (NULL);
+
+	char *footer = map + fileSize - SEEKABLE_FOOTER_BYTES;
+	size_t numFrames = getLe32(footer + 16);
+	size_t tableSize = getLe32(footer + 20);
+	if (memcmp(footer, GZIP_EXTRA_HEADER, GZIP_EXTRA_HEADER_BYTES) != 0 ||
+		footer[12] != 'M' || footer[13] != 'F' ||
+		memcmp(footer + 24, SEEKABLE_MAGIC, 8) != 0 ||
+		tableSize > fileSize - SEEKABLE_FOOTER_BYTES ||
+		numFrames > tableSize / 8) {
+		munmap(map, fileSize);
+		return (NULL);
+	}
+
+	seekable_t *new = xmalloc(sizeof (seekable_t));
+	new->map = map;
+	new->mapSize = fileSize;
+	new->numFrames = numFrames;
+	new->offsets = xmalloc((numFrames + 1) * sizeof (uint64_t));
+	new->compressedOffsets = xmalloc((numFrames + 1) * sizeof (uint64_t));
+	new->offsets[0] = 0;
+	new->compressedOffsets[0] = 0;
+
+	/* every table member is GZIP_EXTRA_HEADER_BYTES + 16 + len bytes */
+	size_t frameNumber = 0;
+	bool isValid = true;
+	char *table = footer - tableSize;
+	while (isValid && table < footer) {
+		size_t remaining = footer - table;
+		size_t len = 0;
+		isValid = (remaining >= GZIP_EXTRA_HEADER_BYTES + 16 &&
+				memcmp(table, GZIP_EXTRA_HEADER, GZIP_EXTRA_HEADER_BYTES) == 0
+				&& table[12] == 'M' && table[13] == 'T');
+		if (isValid) {
+			len = (unsigned char) table[14] | (unsigned char) table[15] << 8;
+			isValid = (len % 8 == 0 && len / 8 <= numFrames - frameNumber &&
+					remaining >= GZIP_EXTRA_HEADER_BYTES + 16 + len);
+		}
+		for (size_t i = 0; isValid && i < len / 8; i++) {
+			size_t compressedSize = getLe32(table + 16 + 8 * i);
+			size_t size = getLe32(table + 16 + 8 * i + 4);
+			isValid = (size <= SEEKABLE_FRAME_BYTES);
+			new->compressedOffsets[frameNumber + 1] =
+				new->compressedOffsets[frameNumber] + compressedSize;
+			new->offsets[frameNumber + 1] = new->offsets[frameNumber] + size;
+			frameNumber++;
+		}
+		table += GZIP_EXTRA_HEADER_BYTES + 16 + len;
+	}
+	if (!isValid || frameNumber != numFrames ||
+		new->compressedOffsets[numFrames] !=
+		fileSize - SEEKABLE_FOOTER_BYTES - tableSize) {
+		munmap(map, fileSize);
+		free(new->offsets);
+		free(new->compressedOffsets);
+		free(new);
+		return (NULL);
+	}
+
+	new->frame = xmalloc(SEEKABLE_FRAME_BYTES);
+	new->frameNumber = numFrames;
+	z_stream *zs = xmalloc(sizeof (z_stream));
+	memset(zs, 0, sizeof (z_stream));
+	if (inflateInit2(zs, 15 + 16) != Z_OK)
+		errx(1, "failed to initialize gzip decompression");
+	new->decoder = zs;
+	return (new);
+#endif
+}
+
+void closeSeekable(seekable_t *seekable) {
+#ifdef HAVE_ZLIB
+	inflateEnd(seekable->decoder);
+#endif
+	munmap(seekable->map, seekable->mapSize);
+	free(seekable->decoder);
+	free(seekable->frame);
+	free(seekable->offsets);
+	free(seekable->compressedOffsets);
+	free(seekable);
+}
+
+/*
+ * decompresses frame frameNumber into the frame buffer. Returns false on
+ * corrupt data.
+ */
+bool decodeFrame(seekable_t *seekable, size_t frameNumber) {
+	bool isValid = false;
+#ifdef HAVE_ZLIB
+	z_stream *zs = seekable->decoder;
+	inflateReset(zs);
+	zs->next_in = (unsigned char *) seekable->map
+				+ seekable->compressedOffsets[frameNumber];
+	zs->avail_in = seekable->compressedOffsets[frameNumber + 1]
+				- seekable->compressedOffsets[frameNumber];
+	zs->next_out = (unsigned char *) seekable->frame;
+	zs->avail_out = SEEKABLE_FRAME_BYTES;
+	isValid = (inflate(zs, Z_FINISH) == Z_STREAM_END &&
+			zs->total_out == seekable->offsets[frameNumber + 1]
+							- seekable->offsets[frameNumber]);
+#endif
+	if (!isValid)
+		return (false);
+	seekable->frameNumber = frameNumber;
+	return (true);
+}
+
+/*
+ * points *data at the uncompressed bytes at the position of a seekable
+ * archive, decompressing the frame holding them if needed, and returns
+ * how many follow in that frame. Returns 0 at the end of the archive, or
+ * with the error of the archive set if the frame is corrupt.
+ */
+size_t peekSeekable(archive_t *archive, char **data) {
+	seekable_t *seekable = archive->seekable;
+	if (archive->offset >= archive->size)
+		return (0);
+
+	size_t frameNumber = seekable->frameNumber;
+	if (frameNumber == seekable->numFrames ||
+		archive->offset < seekable->offsets[frameNumber] ||
+		archive->offset >= seekable->offsets[frameNumber + 1]) {
+		size_t low = 0;
+		size_t high = seekable->numFrames;
+		while (high - low > 1) {
+			size_t middle = (low + high) / 2;
+			if (seekable->offsets[middle] <= archive->offset)
+				low = middle;
+			else
+				high = middle;
+		}
+		if (!decodeFrame(seekable, low)) {
+			archive->error = TAR_ERR_CORRUPT;
+			return (0);
+		}
+		frameNumber = low;
+	}
+	*data = seekable->frame + (archive->offset - seekable->offsets[frameNumber]);
+	return (seekable->offsets[frameNumber + 1] - archive->offset);
+}
+
+/*
+ * reads the next block of the archive and returns the number of bytes
+ * available in it. *block always points to BLOCKSIZE_BYTES readable
+ * bytes: a view into the mapping, or the archive buffer when reading
+ * through stdio or when the mapping ends in a partial block.
+ */
+size_t readBlock(archive_t *archive, char **block) {
+	if (archive->reader == READER_MMAP) {
+		size_t available = 0;
+		if (archive->offset < archive->size)
+			available = archive->size - archive->offset;
+		if (available >= BLOCKSIZE_BYTES) {
+			*block = archive->map + archive->offset;
+			archive->offset += BLOCKSIZE_BYTES;
+			threadStats[STAT_BYTES_READ] += BLOCKSIZE_BYTES;
+			return (BLOCKSIZE_BYTES);
+		}
+		memset(archive->buffer, 0, BLOCKSIZE_BYTES);
+		memcpy(archive->buffer, archive->map + archive->offset, available);
+		archive->offset += available;
+		threadStats[STAT_BYTES_READ] += available;
+		*block = archive->buffer;
+		return (available);
+	}
+
+	memset(archive->buffer, 0, BLOCKSIZE_BYTES);
+	*block = archive->buffer;
+	return (readArchive(archive, archive->buffer, BLOCKSIZE_BYTES));
+}
+
+/*
+ * reads up to len bytes of the archive into buffer and returns how many
+ * were read, less than len only at the end of the archive or if it
+ * cannot be read, which sets its error.
+ */
+size_t readArchive(archive_t *archive, char *buffer, size_t len) {
+	size_t bytesRead = 0;
+	if (archive->reader == READER_MMAP) {
+		if (archive->offset < archive->size)
+			bytesRead = archive->size - archive->offset;
+		if (bytesRead > len)
+			bytesRead = len;
+		memcpy(buffer, archive->map + archive->offset, bytesRead);
+		archive->offset += bytesRead;
+	} else if (archive->reader == READER_SEEKABLE) {
+		while (bytesRead < len) {
+			char *data;
+			size_t available = peekSeekable(archive, &data);
+			if (available == 0)
+				break;
+			if (available > len - bytesRead)
+				available = len - bytesRead;
+			memcpy(buffer + bytesRead, data, available);
+			archive->offset += available;
+			bytesRead += available;
+		}
+	} else if (archive->reader == READER_STREAM) {
+		bytesRead = readStream(archive->stream, buffer, len);
+		archive->offset += bytesRead;
+		if (bytesRead < len && archive->error == TAR_OK)
+			archive->error = archive->stream->error;
+	} else {
+		bytesRead = fread(buffer, sizeof (char), len, archive->file);
+		if (ferror(archive->file))
+			archive->error = TAR_ERR_IO;
+	}
+	threadStats[STAT_BYTES_READ] += bytesRead;
+	return (bytesRead);
+}
+
+/*
+ * returns the next header of the archive, or NULL at end of file. The
+ * header stays valid until the next call, or until the archive is closed
+ * for a mapped archive. A ustar header whose checksum does not match is
+ * reported and skipped along with the blocks after it up to the next
+ * valid header, as GNU tar does; other blocks are returned as they are
+ * for the caller to reject.
+ */
+header_t *readHeader(archive_t *archive) {
+	char *block;
+	if (readBlock(archive, &block) != BLOCKSIZE_BYTES)
+		return (NULL);
+	threadStats[STAT_HEADERS]++;
+	header_t *header = (header_t *) block;
+	if (isTarFile(header->magic)) {
+		unsigned int sum;
+		sumBlocks(block, 1, &sum);
+		if (!isValidChecksum(header, sum)) {
+			fprintf(stderr, MSG_PREFFIX " Skipping to next header\n");
+			archive->numSkippedHeaders++;
+			if (!skipToNextHeader(archive, &block))
+				return (NULL);
+		}
+	}
+	if (archive->reader == READER_MMAP)
+		return ((header_t *) block);
+	memcpy(archive->header.block, block, BLOCKSIZE_BYTES);
+	return (&archive->header);
+}
+
+/*
+ * reads up to the next zero block or valid header into *block. A mapped
+ * archive is scanned in batches. Returns false at end of file.
+ */
+bool skipToNextHeader(archive_t *archive, char **block) {
+	if (archive->reader == READER_MMAP) {
+		size_t numBlocks = (archive->size - archive->offset) / BLOCKSIZE_BYTES;
+		archive->offset += findHeaderBlock(archive->map + archive->offset,
+								numBlocks) * BLOCKSIZE_BYTES;
+		return (readBlock(archive, block) == BLOCKSIZE_BYTES);
+	}
+	while (readBlock(archive, block) == BLOCKSIZE_BYTES) {
+		if (findHeaderBlock(*block, 1) == 0)
+			return (true);
+	}
+	return (false);
+}
+
+/*
+ * returns the header of the next member like readHeader(), after
+ * consuming the pax extended headers before it and the sparse map of a
+ * sparse member, and sets the name, size and sparse map of the member in
+ * the archive. Global extended headers are skipped. Blocks that are not
+ * headers are returned as they are for the caller to reject. Returns
+ * NULL with the error of the archive set if the member is truncated or
+ * its sparse map is invalid.
+ */
+header_t *readMemberHeader(archive_t *archive) {
+	enterPhase(PHASE_SCAN);
+	extended_t extended;
+	memset(&extended, 0, sizeof (extended_t));
+	archive->sparse = NULL;
+	archive->sparseMap.numRegions = 0;
+	archive->sparseMap.realSize = 0;
+	archive->numHeaderBlocks = 0;
+
+	header_t *header;
+	while (1) {
+		header = readHeader(archive);
+		if (header == NULL && archive->numHeaderBlocks > 0 &&
+			archive->error == TAR_OK)
+			archive->error = TAR_ERR_TRUNCATED;
+		if (header == NULL)
+			return (NULL);
+		archive->numHeaderBlocks++;
+		if (!isTarFile(header->magic) ||
+			(header->typeflag != XHDTYPE && header->typeflag != XGLTYPE))
+			break;
+
+		size_t len = getContentSize(header);
+		if (len > MEMBER_MAX_BYTES) {
+			archive->error = TAR_ERR_TRUNCATED;
+			return (NULL);
+		}
+		bool isExtended = (header->typeflag == XHDTYPE);
+		char *records = readExtendedData(archive, len);
+		if (records == NULL)
+			return (NULL);
+		archive->numHeaderBlocks += roundUpToBlock(len) / BLOCKSIZE_BYTES;
+		if (isExtended) {
+			memset(&extended, 0, sizeof (extended_t));
+			archive->sparseMap.numRegions = 0;
+			parseExtendedHeader(archive, records, len, &extended);
+		}
+	}
+
+	archive->memberName = header->name;
+	archive->memberSize = getContentSize(header);
+	if (!isTarFile(header->magic))
+		return (header);
+
+	if (memcmp(header->magic, POSIX_MAGIC, sizeof (POSIX_MAGIC) - 1) == 0 &&
+		header->prefix[0] != '\0') {
+		snprintf(archive->longName, sizeof (archive->longName), "%.*s/%.*s",
+			SIZE_PREFIX_MAX, header->prefix, SIZE_NAME_MAX, header->name);
+		archive->memberName = archive->longName;
+	}
+	if (extended.sparseName != NULL)
+		archive->memberName = extended.sparseName;
+	else if (extended.path != NULL)
+		archive->memberName = extended.path;
+	if (extended.isSizeSet)
+		archive->memberSize = extended.size;
+	/* no archive holds that much data, nor can it be rounded up to
+	 * whole blocks */
+	if (archive->memberSize > MEMBER_MAX_BYTES) {
+		archive->error = TAR_ERR_TRUNCATED;
+		return (NULL);
+	}
+
+	bool isValid = true;
+	if (header->typeflag == GNUTYPE_SPARSE)
+		isValid = readGnuSparseMap(archive, header);
+	else if (extended.isSparse) {
+		archive->sparse = &archive->sparseMap;
+		if (extended.sparseMajor == 1)
+			isValid = readSparseMapData(archive);
+	}
+	if (archive->error != TAR_OK)
+		return (NULL);
+	if (archive->sparse != NULL && (!isValid || !isValidSparseMap(archive))) {
+		archive->error = TAR_ERR_SPARSE_MAP;
+		return (NULL);
+	}
+	return (header);
+}
+
+/*
+ * reads len bytes of member data and their padding into the extended
+ * data buffer of the archive, terminated by a null byte. Returns NULL
+ * if the archive ends first.
+ */
+char *readExtendedData(archive_t *archive, size_t len) {
+	if (len + 1 > archive->extendedCapacity) {
+		archive->extendedCapacity = roundUpToBlock(len + 1);
+		free(archive->extendedData);
+		archive->extendedData = xmalloc(archive->extendedCapacity);
+	}
+	for (size_t i = 0; i < len; i += BLOCKSIZE_BYTES) {
+		char *block;
+		if (readBlock(archive, &block) != BLOCKSIZE_BYTES) {
+			if (archive->error == TAR_OK)
+				archive->error = TAR_ERR_TRUNCATED;
+			return (NULL);
+		}
+		size_t blockLen = (len - i < BLOCKSIZE_BYTES) ? len - i
+						: BLOCKSIZE_BYTES;
+		memcpy(archive->extendedData + i, block, blockLen);
+	}
+	archive->extendedData[len] = '\0';
+	return (archive->extendedData);
+}
+
+/*
+ * parses the records of a pax extended header, "length key=value\n"
+ * each, into extended and the sparse map of the archive. Values are
+ * terminated in place. Unknown keywords are ignored; parsing stops at a
+ * malformed record.
+ */
+void parseExtendedHeader(archive_t *archive, char *records, size_t len,
+		extended_t *extended) {
+	size_t pos = 0;
+	while (pos < len) {
+		char *record = records + pos;
+		char *key;
+		unsigned long long recordLen = strtoull(record, &key, 10);
+		if (key == record || *key != ' ' || recordLen > len - pos ||
+			recordLen < (size_t) (key - record) + 2 ||
+			record[recordLen - 1] != '\n')
+			return;
+		record[recordLen - 1] = '\0';
+		key++;
+		pos += recordLen;
+
+		char *value = strchr(key, '=');
+		if (value == NULL)
+			continue;
+		*value++ = '\0';
+		if (strcmp(key, "path") == 0)
+			extended->path = value;
+		else if (strcmp(key, "size") == 0) {
+			extended->size = strtoull(value, NULL, 10);
+			extended->isSizeSet = true;
+		} else if (strcmp(key, "GNU.sparse.name") == 0)
+			extended->sparseName = value;
+		else if (strcmp(key, "GNU.sparse.realsize") == 0 ||
+			strcmp(key, "GNU.sparse.size") == 0) {
+			archive->sparseMap.realSize = strtoull(value, NULL, 10);
+			extended->isSparse = true;
+		} else if (strcmp(key, "GNU.sparse.major") == 0) {
+			extended->sparseMajor = atoi(value);
+			extended->isSparse = true;
+		} else if (strcmp(key, "GNU.sparse.offset") == 0)
+			extended->sparseOffset = strtoull(value, NULL, 10);
+		else if (strcmp(key, "GNU.sparse.numbytes") == 0)
+			addSparseRegion(&archive->sparseMap, extended->sparseOffset,
+				strtoull(value, NULL, 10));
+		else if (strcmp(key, "GNU.sparse.map") == 0) {
+			/* offset,size,offset,size... */
+			char *cursor = value;
+			while (*cursor != '\0') {
+				uint64_t offset = strtoull(cursor, &cursor, 10);
+				if (*cursor != ',')
+					break;
+				uint64_t size = strtoull(cursor + 1, &cursor, 10);
+				addSparseRegion(&archive->sparseMap, offset, size);
+				if (*cursor == ',')
+					cursor++;
+			}
+		}
+	}
+}
+
+/*
+ * reads the sparse map of an old GNU sparse member from its header and
+ * the extension blocks after it. Returns false if the archive ends
+ * first.
+ */
+bool readGnuSparseMap(archive_t *archive, header_t *header) {
+	sparseMap_t *map = &archive->sparseMap;
+	map->realSize = parseNumeric(header->realSize, sizeof (header->realSize));
+	addSparseRegions(map, header->sparse, SPARSE_HEADER_ENTRIES);
+
+	bool isExtended = header->isExtended;
+	while (isExtended) {
+		char *block;
+		if (readBlock(archive, &block) != BLOCKSIZE_BYTES) {
+			if (archive->error == TAR_OK)
+				archive->error = TAR_ERR_TRUNCATED;
+			return (false);
+		}
+		archive->numHeaderBlocks++;
+		addSparseRegions(map, block, SPARSE_EXTENSION_ENTRIES);
+		isExtended = block[SPARSE_EXTENSION_ENTRIES * SPARSE_ENTRY_BYTES];
+	}
+	archive->sparse = map;
+	return (true);
+}
+
+/*
+ * reads the sparse map of a pax sparse member of format 1.0, held at the
+ * start of its data: decimal numbers on lines of their own, the number of
+ * regions and then the offset and size of each, padded to a block.
+ * Returns false if it is malformed, or if the archive ends first, which
+ * sets its error.
+ */
+bool readSparseMapData(archive_t *archive) {
+	sparseMap_t *map = &archive->sparseMap;
+	uint64_t values[2];
+	int numValues = 0;
+	uint64_t numRegions = 0;
+	bool isCounted = false;
+	uint64_t value = 0;
+	bool hasDigits = false;
+	size_t mapBytes = 0;
+
+	while (!isCounted || map->numRegions < numRegions) {
+		char *block;
+		if (readBlock(archive, &block) != BLOCKSIZE_BYTES) {
+			if (archive->error == TAR_OK)
+				archive->error = TAR_ERR_TRUNCATED;
+			return (false);
+		}
+		archive->numHeaderBlocks++;
+		mapBytes += BLOCKSIZE_BYTES;
+		for (int i = 0; i < BLOCKSIZE_BYTES &&
+			(!isCounted || map->numRegions < numRegions); i++) {
+			char c = block[i];
+			if (c >= '0' && c <= '9') {
+				value = value * 10 + (c - '0');
+				hasDigits = true;
+				continue;
+			}
+			if (c != '\n' || !hasDigits)
+				return (false);
+			if (!isCounted) {
+				numRegions = value;
+				isCounted = true;
+			} else {
+				values[numValues++] = value;
+				if (numValues == 2) {
+					addSparseRegion(map, values[0], values[1]);
+					numValues = 0;
+				}
+			}
+			value = 0;
+			hasDigits = false;
+		}
+	}
+	if (mapBytes > archive->memberSize)
+		return (false);
+	archive->memberSize -= mapBytes;
+	return (true);
+}
+
+void addSparseRegions(sparseMap_t *map, char *entries, size_t numEntries) {
+	for (size_t i = 0; i < numEntries; i++) {
+		char *entry = entries + i * SPARSE_ENTRY_BYTES;
+		if (entry[0] == '\0')
+			break;
+		addSparseRegion(map, parseNumeric(entry, SPARSE_ENTRY_BYTES / 2),
+			parseNumeric(entry + SPARSE_ENTRY_BYTES / 2,
+				SPARSE_ENTRY_BYTES / 2));
+	}
+}
+
+void addSparseRegion(sparseMap_t *map, uint64_t offset, uint64_t len) {
+	if (map->numRegions == map->capacity) {
+		map->capacity = (map->capacity == 0) ? 16 : 2 * map->capacity;
+		map->regions = realloc(map->regions,
+							2 * map->capacity * sizeof (uint64_t));
+		if (map->regions == NULL)
+			err(1, "failed to allocate %zu sparse regions", map->capacity);
+	}
+	map->regions[2 * map->numRegions] = offset;
+	map->regions[2 * map->numRegions + 1] = len;
+	map->numRegions++;
+}
+
+/*
+ * returns true if the regions of the sparse member are in order, inside
+ * the file and add up to its data in the archive.
+ */
+bool isValidSparseMap(archive_t *archive) {
+	sparseMap_t *map = archive->sparse;
+	uint64_t end = 0;
+	uint64_t totalSize = 0;
+	for (size_t i = 0; i < map->numRegions; i++) {
+		uint64_t offset = map->regions[2 * i];
+		uint64_t len = map->regions[2 * i + 1];
+		if (offset < end || len > map->realSize ||
+			offset > map->realSize - len)
+			return (false);
+		end = offset + len;
+		totalSize += len;
+	}
+	return (totalSize == archive->memberSize);
+}
+
+void exitUnexpectedEof() {
+	printf(MSG_PREFFIX " Unexpected EOF in archive\n");
+	printf(MSG_PREFFIX " Error is not recoverable: exiting now\n");
+	exit(ERROR_CODE_TWO);
+}
+
+void exitCannotOpen(char *fileName) {
+	printf(MSG_PREFFIX " %s: Cannot open: %s\n"
+		MSG_PREFFIX " Error is not recoverable: exiting now\n",
+		fileName, strerror(errno));
+	exit(ERROR_CODE_TWO);
+}
+
+/*
+ * reports an error returned by the member iterator and exits.
+ */
+void exitArchiveError(iterator_t *iterator, int status) {
+	stream_t *stream = iterator->archive->stream;
+	char *compression = (stream != NULL &&
+						stream->compression == COMPRESS_ZSTD) ? "zstd" : "gzip";
+	if (status == TAR_ERR_IO)
+		exit(EXIT_FAILURE);
+	if (status == TAR_ERR_CORRUPT)
+		fprintf(stderr, MSG_PREFFIX " invalid %s compressed data\n",
+				compression);
+	if (status == TAR_ERR_TRUNCATED || status == TAR_ERR_CORRUPT)
+		exitUnexpectedEof();
+	if (status == TAR_ERR_COMPRESSION)
+		printf(MSG_PREFFIX " %s support was not compiled in\n", compression);
+	else if (status == TAR_ERR_SPARSE_MAP)
+		printf(MSG_PREFFIX " %s: Invalid sparse map\n",
+				iterator->archive->memberName);
+	else if (status == TAR_ERR_UNSUPPORTED)
+		printf(MSG_PREFFIX " Unsupported header type: %d\n",
+				iterator->header->typeflag);
+	else {
+		printf(MSG_PREFFIX " This does not look like a tar archive\n");
+		printf(MSG_PREFFIX " Exiting with failure status due to"
+				" previous errors\n");
+	}
+	exit(ERROR_CODE_TWO);
+}
+
+/*
+ * returns a header that outlives the next readHeader() call. Views into
+ * a mapping are returned as they are; stdio headers are copied into the
+ * arena.
+ */
+header_t *keepHeader(archive_t *archive, header_t *header, arena_t *arena) {
+	if (archive->reader == READER_MMAP)
+		return (header);
+	header_t *copy = createHeader(arena);
+	memcpy(copy->block, header->block, BLOCKSIZE_BYTES);
+	return (copy);
+}
+
+void skipBytes(archive_t *archive, size_t bytesToSkip) {
+	enterPhase(PHASE_SCAN);
+	threadStats[STAT_BYTES_SKIPPED] += bytesToSkip;
+	if (archive->reader == READER_MMAP || archive->reader == READER_SEEKABLE)
+		archive->offset += bytesToSkip;
+	else if (archive->reader == READER_STREAM) {
+		size_t skipped = readStream(archive->stream, NULL, bytesToSkip);
+		archive->offset += skipped;
+		if (skipped < bytesToSkip)
+			archive->isTruncated = true;
+		if (skipped < bytesToSkip && archive->error == TAR_OK)
+			archive->error = archive->stream->error;
+	} else
+		fseek(archive->file, bytesToSkip, SEEK_CUR);
+}
+
+/*
+ * moves to offset of the archive. Streams can only move forward.
+ */
+void seekArchive(archive_t *archive, size_t offset) {
+	if (archive->reader == READER_MMAP || archive->reader == READER_SEEKABLE)
+		archive->offset = offset;
+	else if (archive->reader == READER_STREAM) {
+		assert(offset >= archive->offset);
+		skipBytes(archive, offset - archive->offset);
+	} else
+		fseek(archive->file, offset, SEEK_SET);
+}
+
+void initIterator(iterator_t *iterator, archive_t *archive) {
+	memset(iterator, 0, sizeof (iterator_t));
+	iterator->archive = archive;
+}
+
+/*
+ * skips what is left of the current member and reads the headers of the
+ * next one. Returns TAR_OK, TAR_END at the end of the archive, or an
+ * error. The header is set with TAR_ERR_NOT_TAR, for a block that is not
+ * a header, and TAR_ERR_UNSUPPORTED, for a member that is neither a file
+ * nor a directory, whose data the next call skips.
+ */
+int nextMember(iterator_t *iterator) {
+	archive_t *archive = iterator->archive;
+	if (iterator->dataLeft > 0) {
+		int status = skipMember(iterator);
+		if (status != TAR_OK)
+			return (status);
+	}
+	adviseArchive(archive);
+
+	header_t *header = readMemberHeader(archive);
+	iterator->header = header;
+	if (header == NULL)
+		return ((archive->error != TAR_OK) ? archive->error : TAR_END);
+
+	if (isZeroBlock(header)) {
+		char *block;
+		iterator->hasEndMarker = true;
+		if (readBlock(archive, &block) != BLOCKSIZE_BYTES)
+			iterator->isLoneZeroBlock = true;
+		iterator->header = NULL;
+		return ((archive->error != TAR_OK) ? archive->error : TAR_END);
+	}
+
+	iterator->name = archive->memberName;
+	iterator->size = archive->memberSize;
+	iterator->sparse = archive->sparse;
+	if (!isTarFile(header->magic))
+		return (TAR_ERR_NOT_TAR);
+	iterator->contentLeft = archive->memberSize;
+	iterator->dataLeft = roundUpToBlock(archive->memberSize);
+	if (!isSupportedMember(header))
+		return (TAR_ERR_UNSUPPORTED);
+	return (TAR_OK);
+}
+
+/*
+ * reads up to len bytes of data of the current member into buffer; the
+ * data of a sparse member is its regions one after the other. Returns
+ * the number of bytes read, 0 once all of it has been, or an error. The
+ * padding is consumed along with the last bytes.
+ */
+ssize_t readMemberData(iterator_t *iterator, char *buffer, size_t len) {
+	archive_t *archive = iterator->archive;
+	if (len > iterator->contentLeft)
+		len = iterator->contentLeft;
+	size_t bytesRead = readArchive(archive, buffer, len);
+	iterator->contentLeft -= bytesRead;
+	iterator->dataLeft -= bytesRead;
+	if (archive->error != TAR_OK)
+		return (archive->error);
+	if (bytesRead < len)
+		return (TAR_ERR_TRUNCATED);
+	if (iterator->contentLeft == 0 && iterator->dataLeft > 0) {
+		int status = skipMember(iterator);
+		if (status != TAR_OK)
+			return (status);
+	}
+	return (bytesRead);
+}
+
+/*
+ * writes the data of the current member not read yet to fd, at the
+ * current offset of fd. The regions of a sparse member are written at
+ * their offsets instead and fd is then extended to the size of the
+ * file, leaving the holes unallocated; fd must be a new file for that.
+ */
+int writeMemberData(iterator_t *iterator, int fd) {
+	archive_t *archive = iterator->archive;
+	sparseMap_t *map = iterator->sparse;
+	size_t bytesToRead = iterator->dataLeft;
+	size_t totalRead = 0;
+	if (map == NULL)
+		totalRead = copyMemberData(archive, fd, iterator->contentLeft,
+						bytesToRead);
+	else {
+		size_t skipped = iterator->size - iterator->contentLeft;
+		bool isComplete = true;
+		for (size_t i = 0; isComplete && i < map->numRegions; i++) {
+			size_t len = map->regions[2 * i + 1];
+			if (len <= skipped) {
+				skipped -= len;
+				continue;
+			}
+			if (lseek(fd, map->regions[2 * i] + skipped, SEEK_SET) == -1)
+				return (TAR_ERR_IO);
+			len -= skipped;
+			skipped = 0;
+			size_t bytesRead = copyMemberData(archive, fd, len, len);
+			totalRead += bytesRead;
+			isComplete = (bytesRead == len);
+		}
+		if (isComplete) {
+			totalRead += copyMemberData(archive, fd, 0,
+							bytesToRead - totalRead);
+			if (ftruncate(fd, map->realSize) == -1)
+				return (TAR_ERR_IO);
+		}
+	}
+	iterator->dataLeft -= totalRead;
+	iterator->contentLeft = (totalRead < iterator->contentLeft)
+							? iterator->contentLeft - totalRead : 0;
+	if (archive->error != TAR_OK)
+		return (archive->error);
+	if (totalRead < bytesToRead)
+		return (TAR_ERR_TRUNCATED);
+	return (TAR_OK);
+}
+
+/*
+ * moves past the data of the current member. Returns TAR_ERR_TRUNCATED
+ * if the archive ends first, or the error of the archive.
+ */
+int skipMember(iterator_t *iterator) {
+	skipBytes(iterator->archive, iterator->dataLeft);
+	iterator->contentLeft = 0;
+	iterator->dataLeft = 0;
+	if (iterator->archive->error != TAR_OK)
+		return (iterator->archive->error);
+	if (checkTruncatedFile(iterator->archive) == -1)
+		return (TAR_ERR_TRUNCATED);
+	return (TAR_OK);
+}
+
+/*
+ * moves to the member whose headers start at offset of the archive, for
+ * the next nextMember(). Streams can only move forward.
+ */
+void seekMember(iterator_t *iterator, size_t offset) {
+	seekArchive(iterator->archive, offset);
+	iterator->contentLeft = 0;
+	iterator->dataLeft = 0;
+}
+
+/*
+ * FNV-1a hash of a member name.
+ */
+uint64_t hashName(char *name) {
+	uint64_t hash = 14695981039346656037ULL;
+	while (*name != '\0') {
+		hash ^= (unsigned char) *name++;
+		hash *= 1099511628211ULL;
+	}
+	return (hash);
+}
+
+char *indexFileName(char *tarArchiveName) {
+	char *name = xmalloc(strlen(tarArchiveName) + sizeof (INDEX_SUFFIX));
+	strcpy(name, tarArchiveName);
+	strcat(name, INDEX_SUFFIX);
+	return (name);
+}
+
+/*
+ * scans the whole archive and writes its sidecar index. The archive is
+ * validated the same way as for -t, so only well formed archives get an
+ * index. The index is written to a temporary file and renamed into
+ * place.
+ */
+void buildIndex(char *tarArchiveName, int compression, int ioPolicy) {
+	archive_t *tarArchive = openArchive(tarArchiveName, compression, ioPolicy);
+	if (tarArchive == NULL) {
+		printf(MSG_PREFFIX " %s file does not exist in current"
+				" directory\n", tarArchiveName);
+		exit(ERROR_CODE_TWO);
+	}
+
+	struct stat st;
+	if (fstat(tarArchive->fd, &st) == -1)
+		err(1, "failed to stat %s", tarArchiveName);
+
+	indexEntry_t *entries = NULL;
+	size_t numEntries = 0;
+	size_t capacity = 0;
+	char *names = NULL;
+	size_t namesSize = 0;
+	size_t namesCapacity = 0;
+	size_t offset = 0;
+	int posZeroBlock = 1;
+	iterator_t iterator;
+	initIterator(&iterator, tarArchive);
+
+	int status;
+	while ((status = nextMember(&iterator)) == TAR_OK) {
+		if (numEntries == capacity) {
+			capacity = (capacity == 0) ? 64 : capacity * 2;
+			entries = realloc(entries, capacity * sizeof (indexEntry_t));
+			if (entries == NULL)
+				err(1, "failed to allocate the index");
+		}
+		header_t *header = iterator.header;
+		indexEntry_t *entry = &entries[numEntries++];
+		memset(entry, 0, sizeof (indexEntry_t));
+		entry->offset = offset;
+		entry->size = iterator.size;
+		entry->mtime = parseNumeric(header->mtime, sizeof (header->mtime));
+		entry->typeflag = header->typeflag;
+		entry->nameOffset = namesSize;
+		entry->nameLength = strlen(iterator.name);
+		if (namesSize + entry->nameLength + 1 > namesCapacity) {
+			while (namesSize + entry->nameLength + 1 > namesCapacity)
+				namesCapacity = (namesCapacity == 0) ? 4096
+								: namesCapacity * 2;
+			names = realloc(names, namesCapacity);
+			if (names == NULL)
+				err(1, "failed to allocate the index");
+		}
+		memcpy(names + namesSize, iterator.name, entry->nameLength + 1);
+		namesSize += entry->nameLength + 1;
+
+		size_t numBlocks = tarArchive->numHeaderBlocks
+						+ iterator.dataLeft / BLOCKSIZE_BYTES;
+		offset += numBlocks * BLOCKSIZE_BYTES;
+		posZeroBlock += numBlocks - 1;
+		if (skipMember(&iterator) != TAR_OK)
+			exitUnexpectedEof();
+	}
+	if (status != TAR_END)
+		exitArchiveError(&iterator, status);
+	bool isLoneZeroBlock = iterator.isLoneZeroBlock;
+	if (isLoneZeroBlock)
+		posZeroBlock++;
+	if (tarArchive->numSkippedHeaders > 0) {
+		fprintf(stderr, MSG_PREFFIX " Exiting with failure status due to"
+				" previous errors\n");
+		exit(ERROR_CODE_TWO);
+	}
+	closeArchive(tarArchive);
+
+	uint64_t numSlots = 1;
+	while (numSlots < 2 * numEntries)
+		numSlots *= 2;
+	uint64_t *slots = calloc(numSlots, sizeof (uint64_t));
+	if (slots == NULL)
+		err(1, "failed to allocate the index");
+	for (size_t i = 0; i < numEntries; i++) {
+		char *name = names + entries[i].nameOffset;
+		uint64_t slot = hashName(name) & (numSlots - 1);
+		while (slots[slot] != 0 &&
+			strcmp(names + entries[slots[slot] - 1].nameOffset, name) != 0)
+			slot = (slot + 1) & (numSlots - 1);
+		if (slots[slot] == 0)
+			slots[slot] = i + 1;
+	}
+
+	indexHeader_t header;
+	memset(&header, 0, sizeof (indexHeader_t));
+	memcpy(header.magic, INDEX_MAGIC, sizeof (header.magic));
+	header.archiveSize = st.st_size;
+	header.archiveMtimeSec = st.st_mtim.tv_sec;
+	header.archiveMtimeNsec = st.st_mtim.tv_nsec;
+	header.numEntries = numEntries;
+	header.numSlots = numSlots;
+	header.posZeroBlock = posZeroBlock;
+	header.isLoneZeroBlock = isLoneZeroBlock;
+	header.namesSize = namesSize;
+
+	char *indexName = indexFileName(tarArchiveName);
+	char *tempName = xmalloc(strlen(indexName) + sizeof (".tmp"));
+	strcpy(tempName, indexName);
+	strcat(tempName, ".tmp");
+	FILE *indexFile = fopen(tempName, "w");
+	if (indexFile == NULL)
+		err(1, "failed to create %s", tempName);
+	if (fwrite(&header, sizeof (indexHeader_t), 1, indexFile) != 1 ||
+		(numEntries > 0 && fwrite(entries, sizeof (indexEntry_t),
+			numEntries, indexFile) != numEntries) ||
+		fwrite(slots, sizeof (uint64_t), numSlots, indexFile) != numSlots ||
+		(namesSize > 0 &&
+			fwrite(names, 1, namesSize, indexFile) != namesSize) ||
+		fclose(indexFile) != 0)
+		err(1, "failed to write %s", tempName);
+	if (rename(tempName, indexName) == -1)
+		err(1, "failed to rename %s", tempName);
+
+	free(tempName);
+	free(indexName);
+	free(slots);
+	free(names);
+	free(entries);
+}
+
+/*
+ * maps the sidecar index of an archive. Returns NULL if there is no
+ * index, or if it is malformed or stale, i.e. the archive size or mtime
+ * no longer match the ones recorded when it was built.
+ */
+index_t *openIndex(char *tarArchiveName) {
+	struct stat archiveSt;
+	if (tarArchiveName == NULL || strcmp(tarArchiveName, STDIN_ARCHIVE) == 0
+		|| stat(tarArchiveName, &archiveSt) == -1)
+		return (NULL);
+
+	char *indexName = indexFileName(tarArchiveName);
+	int fd = open(indexName, O_RDONLY);
+	free(indexName);
+	if (fd == -1)
+		return (NULL);
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof (indexHeader_t)) {
+		close(fd);
+		return (NULL);
+	}
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return (NULL);
+
+	indexHeader_t *header = (indexHeader_t *) map;
+	if (memcmp(header->magic, INDEX_MAGIC, sizeof (header->magic)) != 0 ||
+		header->archiveSize != (uint64_t) archiveSt.st_size ||
+		header->archiveMtimeSec != archiveSt.st_mtim.tv_sec ||
+		header->archiveMtimeNsec != archiveSt.st_mtim.tv_nsec ||
+		!isIndexValid(map, st.st_size)) {
+		munmap(map, st.st_size);
+		return (NULL);
+	}
+
+	index_t *index = xmalloc(sizeof (index_t));
+	index->map = map;
+	index->mapSize = st.st_size;
+	index->header = header;
+	index->entries = (indexEntry_t *) (map + sizeof (indexHeader_t));
+	index->slots = (uint64_t *) (index->entries + header->numEntries);
+	index->names = (char *) (index->slots + header->numSlots);
+	return (index);
+}
+
+/*
+ * checks that the mapped index of mapSize bytes is laid out as
+ * --build-index writes it: sizes adding up to mapSize, a power of two
+ * number of slots above the number of entries and no more of them in
+ * use than entries, so that a probe always ends on an empty slot, slots
+ * naming existing entries, and entries with nul-terminated names inside
+ * the names and offsets inside the archive.
+ */
+bool isIndexValid(char *map, size_t mapSize) {
+	indexHeader_t *header = (indexHeader_t *) map;
+	uint64_t numEntries = header->numEntries;
+	uint64_t numSlots = header->numSlots;
+	size_t bodySize = mapSize - sizeof (indexHeader_t);
+	if (numEntries > bodySize / sizeof (indexEntry_t) ||
+		numSlots > bodySize / sizeof (uint64_t) ||
+		numSlots <= numEntries || (numSlots & (numSlots - 1)) != 0)
+		return (false);
+	size_t tablesSize = numEntries * sizeof (indexEntry_t)
+					+ numSlots * sizeof (uint64_t);
+	if (tablesSize > bodySize || header->namesSize != bodySize - tablesSize)
+		return (false);
+
+	indexEntry_t *entries = (indexEntry_t *) (map + sizeof (indexHeader_t));
+	uint64_t *slots = (uint64_t *) (entries + numEntries);
+	char *names = (char *) (slots + numSlots);
+	uint64_t numUsedSlots = 0;
+	for (uint64_t i = 0; i < numSlots; i++) {
+		if (slots[i] > numEntries)
+			return (false);
+		numUsedSlots += slots[i] != 0;
+	}
+	if (numUsedSlots > numEntries)
+		return (false);
+	for (uint64_t i = 0; i < numEntries; i++) {
+		indexEntry_t *entry = &entries[i];
+		if (entry->nameOffset >= header->namesSize ||
+			entry->nameLength >= header->namesSize - entry->nameOffset ||
+			names[entry->nameOffset + entry->nameLength] != '\0' ||
+			entry->offset >= header->archiveSize)
+			return (false);
+	}
+	return (true);
+}
+
+indexEntry_t *findIndexEntry(index_t *index, char *fileName) {
+	enterPhase(PHASE_MATCH);
+	uint64_t mask = index->header->numSlots - 1;
+	uint64_t slot = hashName(fileName) & mask;
+	for (uint64_t i = 0; i < index->header->numSlots &&
+			index->slots[slot] != 0; i++) {
+		indexEntry_t *entry = &index->entries[index->slots[slot] - 1];
+		if (strcmp(indexEntryName(index, entry), fileName) == 0)
+			return (entry);
+		slot = (slot + 1) & mask;
+	}
+	return (NULL);
+}
+
+char *indexEntryName(index_t *index, indexEntry_t *entry) {
+	return (index->names + entry->nameOffset);
+}
+
+void closeIndex(index_t *index) {
+	munmap(index->map, index->mapSize);
+	free(index);
+}
+
+int compareIndexEntries(const void *a, const void *b) {
+	uint64_t offsetA = (*(indexEntry_t **) a)->offset;
+	uint64_t offsetB = (*(indexEntry_t **) b)->offset;
+	return ((offsetA > offsetB) - (offsetA < offsetB));
+}
+
+/*
+ * checks a whole archive without extracting it and writes the manifest
+ * of its members, one "crc32c size name" line each in archive order, to
+ * manifestName or to the standard output. On top of what reading it
+ * checks anyway, like header checksums and truncated members, the
+ * archive must end in two zero blocks. The CRC32C is the one of the data
+ * as stored, the regions one after the other for a sparse member. The
+ * data of a mapped archive is hashed by numThreads threads. Returns the
+ * number of errors found; members after a fatal error are not listed.
+ */
+int verifyArchive(char *tarArchiveName, int compression, int ioPolicy,
+		char *manifestName, int numThreads) {
+	archive_t *tarArchive = openArchive(tarArchiveName, compression, ioPolicy);
+	if (tarArchive == NULL) {
+		printf(MSG_PREFFIX " %s file does not exist in current"
+				" directory\n", tarArchiveName);
+		exit(ERROR_CODE_TWO);
+	}
+	initCrc32c();
+	bool isMapped = (tarArchive->reader == READER_MMAP);
+
+	arena_t *arena = createArena();
+	verifyMember_t *members = NULL;
+	size_t numMembers = 0;
+	size_t capacity = 0;
+	verifyPool_t pool;
+	pool.archive = tarArchive;
+	pool.totals = threadTotals;
+	pool.pieces = NULL;
+	pool.numPieces = 0;
+	pool.nextPiece = 0;
+	size_t piecesCapacity = 0;
+	char *buffer = isMapped ? NULL : xmalloc(COPY_BUFFER_BYTES);
+
+	int posZeroBlock = 1;
+	iterator_t iterator;
+	initIterator(&iterator, tarArchive);
+	int status;
+	while ((status = nextMember(&iterator)) == TAR_OK ||
+		status == TAR_ERR_UNSUPPORTED) {
+		enterPhase(PHASE_COPY);
+		posZeroBlock += tarArchive->numHeaderBlocks - 1
+					+ iterator.dataLeft / BLOCKSIZE_BYTES;
+		if (numMembers == capacity) {
+			capacity = (capacity == 0) ? 1024 : capacity * 2;
+			members = realloc(members, capacity * sizeof (verifyMember_t));
+			if (members == NULL)
+				err(1, "failed to allocate %zu members", capacity);
+		}
+		verifyMember_t *member = &members[numMembers];
+		member->name = arenaAlloc(arena, strlen(iterator.name) + 1);
+		strcpy(member->name, iterator.name);
+		member->size = iterator.contentLeft;
+		member->firstPiece = pool.numPieces;
+		member->numPieces = 0;
+		member->crc = 0;
+
+		if (isMapped) {
+			size_t available = 0;
+			if (tarArchive->offset < tarArchive->size)
+				available = tarArchive->size - tarArchive->offset;
+			if (available < iterator.contentLeft) {
+				status = TAR_ERR_TRUNCATED;
+				break;
+			}
+			for (size_t done = 0; done < iterator.contentLeft;
+				done += VERIFY_PIECE_BYTES) {
+				if (pool.numPieces == piecesCapacity) {
+					piecesCapacity = (piecesCapacity == 0) ? 1024
+									: piecesCapacity * 2;
+					pool.pieces = realloc(pool.pieces, piecesCapacity
+										* sizeof (verifyPiece_t));
+					if (pool.pieces == NULL)
+						err(1, "failed to allocate %zu pieces",
+							piecesCapacity);
+				}
+				verifyPiece_t *piece = &pool.pieces[pool.numPieces++];
+				piece->offset = tarArchive->offset + done;
+				piece->len = iterator.contentLeft - done;
+				if (piece->len > VERIFY_PIECE_BYTES)
+					piece->len = VERIFY_PIECE_BYTES;
+				member->numPieces++;
+			}
+			if (skipMember(&iterator) != TAR_OK) {
+				status = TAR_ERR_TRUNCATED;
+				break;
+			}
+		} else {
+			ssize_t len;
+			while ((len = readMemberData(&iterator, buffer,
+							COPY_BUFFER_BYTES)) > 0)
+				member->crc = crc32c(member->crc, buffer, len);
+			if (len < 0) {
+				status = (int) len;
+				break;
+			}
+		}
+		numMembers++;
+	}
+
+	if (isMapped)
+		hashPieces(&pool, numThreads);
+
+	enterPhase(PHASE_OUTPUT);
+	FILE *manifest = stdout;
+	if (manifestName != NULL && (manifest = fopen(manifestName, "w")) == NULL)
+		err(1, "failed to create %s", manifestName);
+	for (size_t i = 0; i < numMembers; i++) {
+		verifyMember_t *member = &members[i];
+		for (size_t j = 0; j < member->numPieces; j++) {
+			verifyPiece_t *piece = &pool.pieces[member->firstPiece + j];
+			member->crc = crc32cCombine(member->crc, piece->crc, piece->len);
+		}
+		fprintf(manifest, "%08x %llu %s\n", member->crc,
+				(unsigned long long) member->size, member->name);
+	}
+	if (manifest != stdout && fclose(manifest) != 0)
+		err(1, "failed to write %s", manifestName);
+	fflush(stdout);
+
+	if (status != TAR_END)
+		exitArchiveError(&iterator, status);
+	int numErrors = tarArchive->numSkippedHeaders;
+	if (iterator.isLoneZeroBlock) {
+		printf(MSG_PREFFIX " A lone zero block at %d\n", posZeroBlock + 1);
+		numErrors++;
+	} else if (!iterator.hasEndMarker) {
+		printf(MSG_PREFFIX " End of archive marker is missing\n");
+		numErrors++;
+	}
+
+	closeArchive(tarArchive);
+	releaseArena(arena);
+	free(arena);
+	free(members);
+	free(pool.pieces);
+	free(buffer);
+	return (numErrors);
+}
+
+/*
+ * hashes the pieces of pool with numThreads threads, the calling one
+ * included.
+ */
+void hashPieces(verifyPool_t *pool, int numThreads) {
+	pthread_t *threads = NULL;
+	if (numThreads > 1)
+		threads = xmalloc((numThreads - 1) * sizeof (pthread_t));
+	for (int i = 0; i < numThreads - 1; i++) {
+		if (pthread_create(&threads[i], NULL, verifyWorker, pool) != 0)
+			errx(1, "failed to create verification thread");
+	}
+	hashNextPieces(pool);
+	for (int i = 0; i < numThreads - 1; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+/*
+ * hashes the pieces of pool not taken by another thread yet.
+ */
+void hashNextPieces(verifyPool_t *pool) {
+	enterPhase(PHASE_COPY);
+	while (1) {
+		size_t next = __atomic_fetch_add(&pool->nextPiece, 1,
+						__ATOMIC_RELAXED);
+		if (next >= pool->numPieces)
+			break;
+		verifyPiece_t *piece = &pool->pieces[next];
+		piece->crc = crc32c(0, pool->archive->map + piece->offset,
+						piece->len);
+		threadStats[STAT_BYTES_READ] += piece->len;
+	}
+	enterPhase(PHASE_OTHER);
+}
+
+void *verifyWorker(void *arg) {
+	verifyPool_t *pool = arg;
+	threadTotals = pool->totals;
+	hashNextPieces(pool);
+	mergeThreadStats();
+	return (NULL);
+}
+
+#ifndef MYTAR_LIBRARY
+/*
+ * starts measuring the run for --bench; the results are written when the
+ * process exits, whatever the exit status.
+ */
+void startBench(char *fileName, char *mode, char *archiveName,
+		int numSelected) {
+	benchmark = xmalloc(sizeof (bench_t));
+	benchmark->fileName = fileName;
+	benchmark->mode = mode;
+	benchmark->archiveName = archiveName;
+	benchmark->numSelected = numSelected;
+	clock_gettime(CLOCK_MONOTONIC, &benchmark->start);
+	if (atexit(writeBenchResults) != 0)
+		errx(1, "failed to register the benchmark results");
+}
+
+/*
+ * appends a JSON line with the wall and CPU time, the archive throughput,
+ * the peak RSS and the I/O syscall counts of the run to the --bench file.
+ * The counters come from PROC_IO_FILE and cover every thread.
+ */
+void writeBenchResults() {
+	if (benchmark == NULL)
 		return;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double wallSeconds = (end.tv_sec - benchmark->start.tv_sec)
+						+ (end.tv_nsec - benchmark->start.tv_nsec) / 1e9;
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
 
-	file_t *current = *ptrFilesFound;
-	while (current != NULL) {
-		file_t *minNode = current;
-		file_t *temp = current->next;
-		while (temp != NULL) {
-			if (strcmp(temp->name, minNode->name) < 0)
-				minNode = temp;
-			temp = temp->next;
-		}
-
-		if (minNode != current) {
-			char *tempName = current->name;
-			current->name = minNode->name;
-			minNode->name = tempName;
+	unsigned long long readBytes = 0, writeBytes = 0;
+	unsigned long long readCalls = 0, writeCalls = 0;
+	FILE *io = fopen(PROC_IO_FILE, "r");
+	if (io != NULL) {
+		char line[128];
+		unsigned long long value;
+		while (fgets(line, sizeof (line), io) != NULL) {
+			if (sscanf(line, "rchar: %llu", &value) == 1)
+				readBytes = value;
+			else if (sscanf(line, "wchar: %llu", &value) == 1)
+				writeBytes = value;
+			else if (sscanf(line, "syscr: %llu", &value) == 1)
+				readCalls = value;
+			else if (sscanf(line, "syscw: %llu", &value) == 1)
+				writeCalls = value;
 		}
-		current = current->next;
+		fclose(io);
 	}
-}
 
-int checkTruncatedFile(FILE *tarArchive) {
-	long int currentPosition = ftell(tarArchive);
-	fseek(tarArchive, 0, SEEK_END);
-	long int fileSize = ftell(tarArchive);
-	fseek(tarArchive, currentPosition, SEEK_SET);
-	if (currentPosition > fileSize) {
-		return (-1);
+	struct stat st;
+	unsigned long long archiveBytes = 0;
+	if (benchmark->archiveName != NULL &&
+		stat(benchmark->archiveName, &st) == 0 && S_ISREG(st.st_mode))
+		archiveBytes = st.st_size;
+
+	FILE *results = fopen(benchmark->fileName, "a");
+	if (results == NULL) {
+		warn("failed to open %s", benchmark->fileName);
+		return;
 	}
-	return (0);
+	fprintf(results, "{\"mode\":\"%s\",\"archive\":", benchmark->mode);
+	printJsonString(results, (benchmark->archiveName != NULL)
+		? benchmark->archiveName : "");
+	fprintf(results, ",\"selected\":%d,\"archiveBytes\":%llu,"
+		"\"wallSeconds\":%.6f,\"userSeconds\":%.6f,\"systemSeconds\":%.6f,"
+		"\"mbPerSecond\":%.3f,\"peakRssKb\":%ld,\"readBytes\":%llu,"
+		"\"writeBytes\":%llu,\"readCalls\":%llu,\"writeCalls\":%llu}\n",
+		benchmark->numSelected, archiveBytes, wallSeconds,
+		usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6,
+		(wallSeconds > 0) ? archiveBytes / wallSeconds / 1e6 : 0.0,
+		usage.ru_maxrss, readBytes, writeBytes, readCalls, writeCalls);
+	fclose(results);
+	free(benchmark);
 }
+#endif
 
-bool isTarFile(char *magicField) {
-	if (strcmp(magicField, TAR_MAGIC) == 0)
-	{
-		return (true);
+void printJsonString(FILE *file, char *string) {
+	fputc('"', file);
+	for (; *string != '\0'; string++) {
+		unsigned char c = *string;
+		if (c == '"' || c == '\\')
+			fprintf(file, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(file, "\\u%04x", c);
+		else
+			fputc(c, file);
 	}
-	return (false);
+	fputc('"', file);
 }
 
 /*
- * note on the input argument dataType:
- * dataType = 1 --> header_t
- * dataType = 2 --> file_t
+ * processes every one of numArchives archives in a child process, at
+ * most numWorkers at a time, each worker taking the next archive of the
+ * queue as soon as it is done with one. The output of an archive is
+ * written once those of the archives before it have been, so that it
+ * comes out grouped and in the order of the archives whatever the
+ * scheduling; with isGrouped the standard output of each is preceded
+ * by the name of the archive. As the outputs waiting for their turn are
+ * kept in memory files, at most ARCHIVE_RUNS_AHEAD times numWorkers
+ * archives are started and not written yet, workers waiting for the
+ * oldest of them rather than running further ahead. Returns, in a
+ * child, the archive it is to process with its output redirected. The
+ * parent exits with the worst status of its children.
  */
-void freeList(void *list, int dataType) {
-	if (dataType == 1) {
-		header_t *current = list;
-		while (current != NULL) {
-			header_t *next = current->next;
-			free(current);
-			current = next;
+char *runArchives(char **archiveNames, int numArchives, int numWorkers,
+		bool isGrouped) {
+	archiveRun_t *runs = xmalloc(numArchives * sizeof (archiveRun_t));
+	int nextToStart = 0;
+	int nextToWrite = 0;
+	int numRunning = 0;
+	int exitStatus = 0;
+	bool isFirst = true;
+	fflush(stdout);
+	fflush(stderr);
+
+	while (nextToWrite < numArchives) {
+		while (numRunning < numWorkers && nextToStart < numArchives &&
+			nextToStart - nextToWrite < ARCHIVE_RUNS_AHEAD * numWorkers) {
+			archiveRun_t *run = &runs[nextToStart];
+			run->outFd = memfd_create("stdout", 0);
+			run->errFd = memfd_create("stderr", 0);
+			if (run->outFd == -1 || run->errFd == -1)
+				err(1, "failed to create the output of %s",
+					archiveNames[nextToStart]);
+			run->isDone = false;
+			run->pid = fork();
+			if (run->pid == -1)
+				err(1, "failed to start %s", archiveNames[nextToStart]);
+			if (run->pid == 0) {
+				if (dup2(run->outFd, STDOUT_FILENO) == -1 ||
+					dup2(run->errFd, STDERR_FILENO) == -1)
+					exit(ERROR_CODE_TWO);
+				for (int i = nextToWrite; i <= nextToStart; i++) {
+					close(runs[i].outFd);
+					close(runs[i].errFd);
+				}
+				char *archiveName = archiveNames[nextToStart];
+				free(runs);
+				memset(threadStats, 0, sizeof (threadStats));
+				return (archiveName);
+			}
+			numRunning++;
+			nextToStart++;
 		}
-	} else if (dataType == 2) {
-		file_t *current = list;
-		while (current != NULL) {
-			file_t *next = current->next;
-			free(current);
-			current = next;
+
+		int status;
+		pid_t pid = wait(&status);
+		if (pid == -1) {
+			if (errno == EINTR)
+				continue;
+			err(1, "failed to wait for the archives");
 		}
-	} else {
-		printf("Invalid dataType\n");
-	}
-}
+		for (int i = nextToWrite; i < nextToStart; i++) {
+			if (runs[i].pid == pid) {
+				runs[i].isDone = true;
+				break;
+			}
+		}
+		int childStatus = WIFEXITED(status) ? WEXITSTATUS(status)
+						: ERROR_CODE_TWO;
+		if (childStatus > exitStatus)
+			exitStatus = childStatus;
+		numRunning--;
 
-void *xmalloc(size_t len)
-{
-	assert(len != 0);
-	void *buf;
-	if ((buf = malloc(len)) == NULL)
-		err(1, "failed to allocate %zu bytes", len);
-	return (buf);
+		while (nextToWrite < nextToStart && runs[nextToWrite].isDone) {
+			writeArchiveOutput(&runs[nextToWrite], archiveNames[nextToWrite],
+				isGrouped, &isFirst);
+			nextToWrite++;
+		}
+	}
+	free(runs);
+	exit(exitStatus);
 }
 
-void extractEmptyFile(char *fileName) {
-	FILE *newFile = fopen(fileName, "w");
-	if (newFile == NULL) {
-		printf("Error creating the file: %s\n", fileName);
-	} else {
-		fclose(newFile);
+/*
+ * writes what the child processing an archive wrote, its standard output
+ * then its standard error, and closes its memory files. isFirst is
+ * cleared once a group has been written.
+ */
+void writeArchiveOutput(archiveRun_t *run, char *archiveName,
+		bool isGrouped, bool *isFirst) {
+	enterPhase(PHASE_OUTPUT);
+	char *buffer = xmalloc(COPY_BUFFER_BYTES);
+	int fds[2] = { run->outFd, run->errFd };
+	for (int i = 0; i < 2; i++) {
+		int fdOut = (i == 0) ? STDOUT_FILENO : STDERR_FILENO;
+		off_t offset = 0;
+		ssize_t len;
+		while ((len = pread(fds[i], buffer, COPY_BUFFER_BYTES, offset)) > 0) {
+			if (offset == 0 && i == 0 && isGrouped) {
+				char *separator = *isFirst ? "" : "\n";
+				*isFirst = false;
+				writeOrExit(fdOut, separator, strlen(separator));
+				writeOrExit(fdOut, archiveName, strlen(archiveName));
+				writeOrExit(fdOut, ":\n", 2);
+			}
+			writeOrExit(fdOut, buffer, len);
+			offset += len;
+		}
+		close(fds[i]);
 	}
+	free(buffer);
 }
 
+#ifndef MYTAR_LIBRARY
 int main(int argc, char *argv[]) {
 	if (argc < MIN_NUM_OF_ARGUMENTS)
 		exit(ERROR_CODE_TWO);
+	uint64_t startNanos = nowNanos();
 
+	int c = 0;
 	int f = 0;
+	int r = 0;
 	int t = 0;
+	int u = 0;
 	int v = 0;
 	int x = 0;
+	int idx = 0;
+	int verify = 0;
+	char *manifestName = NULL;
+	int listFormat = LIST_TEXT;
+	char **archiveNames = NULL;
+	int numArchives = 0;
+	int archivesCapacity = 0;
+	char *missingName = argv[2];
+	int stats = 0;
+	int numJobs = 1;
+	int numArchiveJobs = 0;
+	int queueDepth = 0;
+	int skipUnchanged = UNCHANGED_OFF;
+	int numUnchanged = 0;
+	char *generateArg = NULL;
+	char *benchFileName = NULL;
+	bool isHeaderSkipped = false;
+	int compression = COMPRESS_AUTO;
+	int ioPolicy = IO_CACHE;
 	char *tarArchiveName = NULL;
 	char **fileNamesArgs = NULL;
 	int numFileNamesArgs = 0;
+	int fileNamesCapacity = 0;
+	char **nameLists = NULL;
+	int numNameLists = 0;
+	int nameListsCapacity = 0;
+	char *nameList;
+	matcher_t *matcher = createMatcher();
+	bool isWildcards = false;
 
 	for (int i = 1; i < argc; i++) {
 		if (argv[i][0] == '-') {
 			switch (argv[i][1]) {
+			case 'c':
+				c = 1;
+				break;
+
 			case 'f':
 				f = 1;
-				if (strncmp(argv[i+1], "-", 1) != 0) {
-					tarArchiveName = argv[i+1];
+				if (strncmp(argv[i+1], "-", 1) != 0 ||
+					strcmp(argv[i+1], STDIN_ARCHIVE) == 0) {
+					if (tarArchiveName == NULL)
+						tarArchiveName = argv[i+1];
+					addName(&archiveNames, &numArchives, &archivesCapacity,
+						argv[i+1]);
 					i++;
 				} else {
 					printf(MSG_PREFFIX " option requires an argument -- 'f'\n"
@@ -365,10 +6135,46 @@ int main(int argc, char *argv[]) {
 				}
 				break;
 
+			case 'r':
+				r = 1;
+				break;
+
 			case 't':
 				t = 1;
 				break;
 
+			case 'u':
+				u = 1;
+				break;
+
+			case 'T':
+				if (argv[i+1] == NULL) {
+					printf(MSG_PREFFIX " option requires an argument -- 'T'\n"
+						"Try './mytar --help' or './mytar --usage' for more"
+						" information.\n");
+					exit(ERROR_CODE_TWO);
+				}
+				nameList = readNameList(argv[i+1], &fileNamesArgs,
+								&numFileNamesArgs, &fileNamesCapacity);
+				if (nameList == NULL)
+					exitCannotOpen(argv[i+1]);
+				addName(&nameLists, &numNameLists, &nameListsCapacity,
+					nameList);
+				i++;
+				break;
+
+			case 'j':
+				if (argv[i+1] == NULL || atoi(argv[i+1]) < 1) {
+					printf(MSG_PREFFIX " option requires a positive number"
+						" -- 'j'\n"
+						"Try './mytar --help' or './mytar --usage' for more"
+						" information.\n");
+					exit(ERROR_CODE_TWO);
+				}
+				numJobs = atoi(argv[i+1]);
+				i++;
+				break;
+
 			case 'v':
 				v = 1;
 				break;
@@ -377,6 +6183,154 @@ int main(int argc, char *argv[]) {
 				x = 1;
 				break;
 
+			case 'z':
+				compression = COMPRESS_GZIP;
+				break;
+
+			case '-':
+				if (strcmp(argv[i], OPT_BUILD_INDEX) == 0) {
+					idx = 1;
+					break;
+				}
+				if (strcmp(argv[i], OPT_STATS) == 0) {
+					stats = 1;
+					break;
+				}
+				if (strcmp(argv[i], OPT_ZSTD) == 0) {
+					compression = COMPRESS_ZSTD;
+					break;
+				}
+				if (strcmp(argv[i], OPT_IO_URING) == 0) {
+					if (queueDepth == 0)
+						queueDepth = URING_QUEUE_DEPTH;
+					break;
+				}
+				if (strcmp(argv[i], OPT_QUEUE_DEPTH) == 0) {
+					if (argv[i+1] == NULL || atoi(argv[i+1]) < 1 ||
+						atoi(argv[i+1]) > URING_MAX_QUEUE_DEPTH) {
+						printf(MSG_PREFFIX " option requires a number from 1"
+							" to %d -- 'queue-depth'\n"
+							"Try './mytar --help' or './mytar --usage' for"
+							" more information.\n", URING_MAX_QUEUE_DEPTH);
+						exit(ERROR_CODE_TWO);
+					}
+					queueDepth = atoi(argv[i+1]);
+					i++;
+					break;
+				}
+				if (strcmp(argv[i], OPT_ARCHIVES_FROM) == 0) {
+					if (argv[i+1] == NULL) {
+						printf(MSG_PREFFIX " option requires an argument --"
+							" '%s'\n"
+							"Try './mytar --help' or './mytar --usage' for"
+							" more information.\n", argv[i] + 2);
+						exit(ERROR_CODE_TWO);
+					}
+					f = 1;
+					nameList = readNameList(argv[i+1], &archiveNames,
+									&numArchives, &archivesCapacity);
+					if (nameList == NULL)
+						exitCannotOpen(argv[i+1]);
+					addName(&nameLists, &numNameLists, &nameListsCapacity,
+						nameList);
+					if (numArchives > 0 && tarArchiveName == NULL)
+						tarArchiveName = archiveNames[0];
+					i++;
+					break;
+				}
+				if (strcmp(argv[i], OPT_ARCHIVE_JOBS) == 0) {
+					if (argv[i+1] == NULL || atoi(argv[i+1]) < 1 ||
+						atoi(argv[i+1]) > ARCHIVE_MAX_JOBS) {
+						printf(MSG_PREFFIX " option requires a number from 1"
+							" to %d -- 'archive-jobs'\n"
+							"Try './mytar --help' or './mytar --usage' for"
+							" more information.\n", ARCHIVE_MAX_JOBS);
+						exit(ERROR_CODE_TWO);
+					}
+					numArchiveJobs = atoi(argv[i+1]);
+					i++;
+					break;
+				}
+				if (strcmp(argv[i], OPT_WILDCARDS) == 0 ||
+					strcmp(argv[i], OPT_NO_WILDCARDS) == 0) {
+					isWildcards = (strcmp(argv[i], OPT_WILDCARDS) == 0);
+					break;
+				}
+				if (strcmp(argv[i], OPT_NO_MATCH_SLASH) == 0) {
+					matcher->isSlashMatched = false;
+					break;
+				}
+				if (strcmp(argv[i], OPT_NULL) == 0) {
+					listFormat = LIST_NUL;
+					break;
+				}
+				if (strcmp(argv[i], OPT_JSON) == 0) {
+					listFormat = LIST_JSON;
+					break;
+				}
+				if (strcmp(argv[i], OPT_VERIFY) == 0) {
+					verify = 1;
+					break;
+				}
+				if (strncmp(argv[i], OPT_VERIFY "=", sizeof (OPT_VERIFY)) == 0) {
+					verify = 1;
+					manifestName = argv[i] + sizeof (OPT_VERIFY);
+					break;
+				}
+				if (strcmp(argv[i], OPT_SKIP_UNCHANGED) == 0) {
+					skipUnchanged = UNCHANGED_STAT;
+					break;
+				}
+				if (strcmp(argv[i], OPT_SKIP_UNCHANGED "=contents") == 0) {
+					skipUnchanged = UNCHANGED_CONTENTS;
+					break;
+				}
+				if (strncmp(argv[i], OPT_IO_POLICY "=",
+						sizeof (OPT_IO_POLICY)) == 0) {
+					char *policy = argv[i] + sizeof (OPT_IO_POLICY);
+					if (strcmp(policy, "cache") == 0)
+						ioPolicy = IO_CACHE;
+					else if (strcmp(policy, "nocache") == 0)
+						ioPolicy = IO_NOCACHE;
+					else if (strcmp(policy, "direct") == 0)
+						ioPolicy = IO_DIRECT;
+					else {
+						printf(MSG_PREFFIX " invalid argument '%s' for '"
+							OPT_IO_POLICY "'\n"
+							"Valid arguments are 'cache', 'nocache' and"
+							" 'direct'\n", policy);
+						exit(ERROR_CODE_TWO);
+					}
+					break;
+				}
+				if (strncmp(argv[i], OPT_EXCLUDE "=",
+						sizeof (OPT_EXCLUDE)) == 0) {
+					addGlobPattern(matcher, argv[i] + sizeof (OPT_EXCLUDE),
+						true);
+					break;
+				}
+				if (strcmp(argv[i], OPT_GENERATE) == 0 ||
+					strcmp(argv[i], OPT_BENCH) == 0 ||
+					strcmp(argv[i], OPT_EXCLUDE) == 0) {
+					if (argv[i+1] == NULL) {
+						printf(MSG_PREFFIX " option requires an argument --"
+							" '%s'\n"
+							"Try './mytar --help' or './mytar --usage' for"
+							" more information.\n", argv[i] + 2);
+						exit(ERROR_CODE_TWO);
+					}
+					if (strcmp(argv[i], OPT_GENERATE) == 0)
+						generateArg = argv[i+1];
+					else if (strcmp(argv[i], OPT_BENCH) == 0)
+						benchFileName = argv[i+1];
+					else
+						addGlobPattern(matcher, argv[i+1], true);
+					i++;
+					break;
+				}
+				printf(MSG_PREFFIX " Unknown option: %s\n", argv[i]);
+				exit(ERROR_CODE_TWO);
+
 			default:
 				printf(MSG_PREFFIX " Unknown option: %s\n", argv[i]);
 				exit(ERROR_CODE_TWO);
@@ -386,14 +6340,9 @@ int main(int argc, char *argv[]) {
 				" '--delete' or '--test-label' options\n"
 				"Try 'tar --help' or 'tar --usage' for more information.\n");
 			exit(ERROR_CODE_TWO);
-		} else if (f || t || v || x) {
-			fileNamesArgs = realloc(fileNamesArgs, (numFileNamesArgs + 1) * sizeof (char *));
-			if (fileNamesArgs == NULL) {
-				free(fileNamesArgs);
-				exit(EXIT_FAILURE);
-			}
-			fileNamesArgs[numFileNamesArgs] = argv[i];
-			numFileNamesArgs++;
+		} else if (c || f || r || t || u || v || x || idx) {
+			addName(&fileNamesArgs, &numFileNamesArgs, &fileNamesCapacity,
+				argv[i]);
 		} else {
 			printf(MSG_PREFFIX " You must specify one of the '-Acdtrux',"
 				" '--delete' or '--test-label' options\n"
@@ -402,19 +6351,22 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
-	FILE * tarArchive = NULL;
+	stats_t totals;
+	initStats(&totals, stats);
+	archive_t *tarArchive = NULL;
 	int filesFoundCount = 0;
 	int filesNotFoundCount = 0;
-	file_t *filesFound = NULL;
-	file_t *filesNotFound = NULL;
-	int numOptions = f + t + v + x;
+	arena_t *arena = createArena();
+	memberTable_t *filesFound = createMemberTable(arena);
+	memberTable_t *filesNotFound = createMemberTable(arena);
+	int numOptions = c + f + r + t + u + v + x + idx + verify;
 	bool isFileTruncated = false;
-	header_t * list = NULL;
-	file_t *listFilesExtracted = NULL;
-	file_t *listFilesTruncated = NULL;
+	memberTable_t *members = createMemberTable(arena);
+	memberTable_t *listFilesExtracted = createMemberTable(arena);
+	memberTable_t *listFilesTruncated = createMemberTable(arena);
 
 	if (v) {
-		if (!x || t)
+		if ((!x && !c && !r && !u) || t)
 			v = 0;
 		if (numOptions == 1) {
 			printf(MSG_PREFFIX " You must specify one of the '-Acdtrux',"
@@ -424,6 +6376,207 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	/* with --wildcards, names with wildcards select the members they
+	 * match; otherwise, as in GNU tar, every name is taken literally */
+	if (isWildcards && !c && !r && !u) {
+		int numNames = 0;
+		for (int i = 0; i < numFileNamesArgs; i++) {
+			if (isGlobPattern(fileNamesArgs[i]))
+				addGlobPattern(matcher, fileNamesArgs[i], false);
+			else
+				fileNamesArgs[numNames++] = fileNamesArgs[i];
+		}
+		numFileNamesArgs = numNames;
+	}
+	bool isSelecting = (numFileNamesArgs > 0 || matcher->numIncludes > 0);
+
+	if (benchFileName != NULL) {
+		char *mode = "t";
+		if (generateArg != NULL)
+			mode = "generate";
+		else if (c)
+			mode = "c";
+		else if (r || u)
+			mode = r ? "r" : "u";
+		else if (idx)
+			mode = "index";
+		else if (verify)
+			mode = "verify";
+		else if (x)
+			mode = isSelecting ? "x-selected" : "x";
+		startBench(benchFileName, mode, tarArchiveName, numFileNamesArgs);
+	}
+
+	/* with several archives, every one is processed by a child process
+	 * going on from here, and this one only waits for them. -j stays the
+	 * number of workers of each archive and --archive-jobs sets how many
+	 * archives are processed at once, ARCHIVE_JOBS at most by default */
+	if (numArchives > 1) {
+		if (c || r || u || generateArg != NULL) {
+			printf(MSG_PREFFIX " Options '-Acru' take a single archive\n"
+				"Try 'tar --help' or 'tar --usage' for more information.\n");
+			exit(ERROR_CODE_TWO);
+		}
+		/* the manifests are written grouped like the rest of the output */
+		if (manifestName != NULL) {
+			printf(MSG_PREFFIX " Option '" OPT_VERIFY "=FILE' takes a single"
+				" archive\n"
+				"Try 'tar --help' or 'tar --usage' for more information.\n");
+			exit(ERROR_CODE_TWO);
+		}
+		for (int i = 0; i < numArchives; i++) {
+			if (strcmp(archiveNames[i], STDIN_ARCHIVE) == 0) {
+				printf(MSG_PREFFIX " Only a single archive can be read from"
+					" '-f -'\n"
+					"Try 'tar --help' or 'tar --usage' for more"
+					" information.\n");
+				exit(ERROR_CODE_TWO);
+			}
+		}
+		int numWorkers = numArchiveJobs;
+		if (numWorkers == 0) {
+			numWorkers = sysconf(_SC_NPROCESSORS_ONLN) / numJobs;
+			if (numWorkers > ARCHIVE_JOBS)
+				numWorkers = ARCHIVE_JOBS;
+		}
+		if (numWorkers > numArchives)
+			numWorkers = numArchives;
+		if (numWorkers < 1)
+			numWorkers = 1;
+		tarArchiveName = runArchives(archiveNames, numArchives, numWorkers,
+							listFormat == LIST_TEXT);
+		benchmark = NULL;
+		missingName = tarArchiveName;
+	}
+
+	if (generateArg != NULL) {
+		if (!f) {
+			printf(MSG_PREFFIX " Refusing to write archive contents to"
+					" terminal (missing -f option?)\n"
+					MSG_PREFFIX " Error is not recoverable: exiting now\n");
+			exit(ERROR_CODE_TWO);
+		}
+		generateSpec_t spec;
+		parseGenerateSpec(generateArg, &spec);
+		int status = generateArchive(tarArchiveName, &spec,
+						(compression == COMPRESS_AUTO) ? COMPRESS_NONE
+						: compression);
+		if (status != 0)
+			exit(status);
+	}
+
+	if (c) {
+		if (t || x || r || u) {
+			printf(MSG_PREFFIX " You may not specify more than one '-Acdtrux',"
+				" '--delete' or  '--test-label' option\n"
+				"Try 'tar --help' or 'tar --usage' for more information.\n");
+			exit(ERROR_CODE_TWO);
+		}
+		if (!f) {
+			printf(MSG_PREFFIX " Refusing to write archive contents to"
+					" terminal (missing -f option?)\n"
+					MSG_PREFFIX " Error is not recoverable: exiting now\n");
+			exit(ERROR_CODE_TWO);
+		}
+		if (numFileNamesArgs == 0) {
+			printf(MSG_PREFFIX " Cowardly refusing to create an empty"
+					" archive\n"
+					"Try 'tar --help' or 'tar --usage' for more information.\n");
+			exit(ERROR_CODE_TWO);
+		}
+		if (compression == COMPRESS_AUTO)
+			compression = COMPRESS_NONE;
+
+		int numReaders = (numJobs > 1) ? numJobs : CREATE_READERS;
+		int status = createArchive(tarArchiveName, fileNamesArgs,
+						numFileNamesArgs, numReaders, v, compression, -1,
+						NULL, NULL);
+		if (status != 0) {
+			fprintf(stderr, MSG_PREFFIX " Exiting with failure status due to"
+					" previous errors\n");
+			exit(status);
+		}
+	}
+
+	if (r || u) {
+		if (t || x || (r && u)) {
+			printf(MSG_PREFFIX " You may not specify more than one '-Acdtrux',"
+				" '--delete' or  '--test-label' option\n"
+				"Try 'tar --help' or 'tar --usage' for more information.\n");
+			exit(ERROR_CODE_TWO);
+		}
+		if (!f) {
+			printf(MSG_PREFFIX " Refusing to write archive contents to"
+					" terminal (missing -f option?)\n"
+					MSG_PREFFIX " Error is not recoverable: exiting now\n");
+			exit(ERROR_CODE_TWO);
+		}
+		if (strcmp(tarArchiveName, STDIN_ARCHIVE) == 0) {
+			printf(MSG_PREFFIX " Options '-Aru' are incompatible with"
+					" '-f -'\n"
+					"Try 'tar --help' or 'tar --usage' for more information.\n");
+			exit(ERROR_CODE_TWO);
+		}
+		if (compression != COMPRESS_AUTO && compression != COMPRESS_NONE) {
+			printf(MSG_PREFFIX " Cannot update compressed archives\n");
+			printf(MSG_PREFFIX " Error is not recoverable: exiting now\n");
+			exit(ERROR_CODE_TWO);
+		}
+
+		int numReaders = (numJobs > 1) ? numJobs : CREATE_READERS;
+		int status = 0;
+		if (numFileNamesArgs > 0)
+			status = appendArchive(tarArchiveName, fileNamesArgs,
+						numFileNamesArgs, numReaders, v, u);
+		if (status != 0) {
+			fprintf(stderr, MSG_PREFFIX " Exiting with failure status due to"
+					" previous errors\n");
+			exit(status);
+		}
+	}
+
+	if (idx) {
+		if (!f) {
+			printf(MSG_PREFFIX " Refusing to read archive contents from"
+					" terminal (missing -f option?)\n"
+					MSG_PREFFIX " Error is not recoverable: exiting now\n");
+			exit(ERROR_CODE_TWO);
+		}
+		if (strcmp(tarArchiveName, STDIN_ARCHIVE) == 0) {
+			printf(MSG_PREFFIX " Cannot build an index of the standard"
+					" input\n");
+			exit(ERROR_CODE_TWO);
+		}
+		buildIndex(tarArchiveName, compression, ioPolicy);
+	}
+
+	if (verify) {
+		if (c || r || u || t || x) {
+			printf(MSG_PREFFIX " You may not specify more than one '-Acdtrux',"
+				" '--delete' or  '--test-label' option\n"
+				"Try 'tar --help' or 'tar --usage' for more information.\n");
+			exit(ERROR_CODE_TWO);
+		}
+		if (!f) {
+			printf(MSG_PREFFIX " Refusing to read archive contents from"
+					" terminal (missing -f option?)\n"
+					MSG_PREFFIX " Error is not recoverable: exiting now\n");
+			exit(ERROR_CODE_TWO);
+		}
+
+		int numThreads = numJobs;
+		if (numThreads == 1 && numArchives <= 1)
+			numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (numThreads < 1)
+			numThreads = 1;
+		if (verifyArchive(tarArchiveName, compression, ioPolicy, manifestName,
+				numThreads) > 0) {
+			fprintf(stderr, MSG_PREFFIX " Exiting with failure status due to"
+					" previous errors\n");
+			exit(ERROR_CODE_TWO);
+		}
+	}
+
 	if (numOptions == 0) {
 		printf(MSG_PREFFIX " You must specify one of the '-Acdtrux',"
 				" '--delete' or '--test-label' options\n"
@@ -440,208 +6593,185 @@ int main(int argc, char *argv[]) {
 				MSG_PREFFIX " Error is not recoverable: exiting now\n");
 		exit(ERROR_CODE_TWO);
 	} else if (f && t) {
-		tarArchive = fopen(tarArchiveName, "r");
-		if (tarArchive == NULL) {
-			printf(MSG_PREFFIX " %s file does not exist in current"
-					" directory\n", argv[2]);
-			exit(ERROR_CODE_TWO);
-		}
+		/* the index keeps no headers for JSON lines */
+		index_t *index = NULL;
+		if (numFileNamesArgs > 0 && matcher->numPatterns == 0 &&
+			listFormat != LIST_JSON)
+			index = openIndex(tarArchiveName);
+
+		/* the whole archive and members matched by patterns are listed
+		 * in archive order as their headers are read, so that memory
+		 * does not grow with the archive; names given as they are, in
+		 * the order of the command line once it has been read */
+		bool isStreamed = (!isSelecting || matcher->numIncludes > 0);
+		if (!isatty(STDOUT_FILENO) &&
+			setvbuf(stdout, NULL, _IOFBF, LIST_BUFFER_BYTES) != 0)
+			err(1, "failed to allocate the output buffer");
 
 		int posZeroBlock = 1;
 		bool isLoneZeroBlock = false;
 
-		while (1) {
-			header_t *newHeader = createHeader();
-			size_t element_read = fread((newHeader->block),
-								sizeof (newHeader->block), 1, tarArchive);
-			if (ferror(tarArchive)) {
-				free(newHeader);
-				exit(EXIT_FAILURE);
+		if (index != NULL) {
+			posZeroBlock = index->header->posZeroBlock;
+			isLoneZeroBlock = index->header->isLoneZeroBlock;
+		} else {
+			tarArchive = openArchive(tarArchiveName, compression, ioPolicy);
+			if (tarArchive == NULL) {
+				printf(MSG_PREFFIX " %s file does not exist in current"
+						" directory\n", missingName);
+				exit(ERROR_CODE_TWO);
 			}
 
-			if (element_read != 1)
-				break;
+			/* with names, only the members asked for are kept */
+			memberTable_t *filesRequested = createMemberTable(arena);
+			for (int i = 0; i < numFileNamesArgs; i++)
+				addMember(filesRequested, fileNamesArgs[i], NULL);
 
-			if (isZeroBlock(newHeader) == true) {
-				if (fread((newHeader->block),
-					sizeof (newHeader->block), 1, tarArchive) != 1) {
-					posZeroBlock ++;
-					isLoneZeroBlock = true;
+			iterator_t iterator;
+			initIterator(&iterator, tarArchive);
+			int status;
+			while ((status = nextMember(&iterator)) == TAR_OK) {
+				char *memberName = iterator.name;
+				if (isSelectedMember(filesRequested, matcher, memberName)) {
+					if (isStreamed)
+						printListEntry(stdout, listFormat, memberName,
+							iterator.header, iterator.size);
+					if ((!isStreamed || findMember(filesRequested,
+							memberName) != NULL) &&
+						findMember(members, memberName) == NULL) {
+						header_t *header = keepHeader(tarArchive,
+											iterator.header, arena);
+						addMember(members, memberName, header);
+					}
 				}
-				if (ferror(tarArchive))
-					exit(EXIT_FAILURE);
-				break;
-			}
-
-			if (isTarFile(newHeader->magic) == false) {
-				printf(MSG_PREFFIX " This does not look like a tar archive\n");
-				printf(MSG_PREFFIX " Exiting with failure status due to"
-						" previous errors\n");
-				exit(ERROR_CODE_TWO);
-			}
 
-			if ((newHeader->typeflag != REGTYPE) &&
-				newHeader->typeflag != AREGTYPE) {
-				printf(MSG_PREFFIX " Unsupported header type: %d\n",
-						newHeader->typeflag);
-				exit(ERROR_CODE_TWO);
+				posZeroBlock += tarArchive->numHeaderBlocks - 1
+							+ iterator.dataLeft / BLOCKSIZE_BYTES;
+				if (skipMember(&iterator) != TAR_OK) {
+					if (!isStreamed)
+						printf("%s\n", memberName);
+					exitUnexpectedEof();
+				}
 			}
-
-			list = addHeader(list, newHeader);
-
-			size_t bytesToSkip = countBytesToSkip(newHeader);
-			fseek(tarArchive, bytesToSkip, SEEK_CUR);
-			while (bytesToSkip > 0) {
-				bytesToSkip -= BLOCKSIZE_BYTES;
+			if (status != TAR_END)
+				exitArchiveError(&iterator, status);
+			if (iterator.isLoneZeroBlock) {
 				posZeroBlock++;
+				isLoneZeroBlock = true;
 			}
-
-			if (checkTruncatedFile(tarArchive) == -1) {
-				printf("%s\n", newHeader->name);
-				printf(MSG_PREFFIX " Unexpected EOF in archive\n");
-				printf(MSG_PREFFIX " Error is not recoverable: exiting now\n");
-				exit(ERROR_CODE_TWO);
-			}
+			freeMemberTable(filesRequested);
+			fflush(stdout);
 		}
-		fclose(tarArchive);
 
-		if (numFileNamesArgs == 0)
-			printNameHeaders(list);
-		else {
+		if (isSelecting && matcher->numIncludes > 0) {
+			for (int i = 0; i < numFileNamesArgs; i++) {
+				if (findMember(members, fileNamesArgs[i]) == NULL) {
+					addMember(filesNotFound, fileNamesArgs[i], NULL);
+					filesNotFoundCount++;
+				}
+			}
+			filesNotFoundCount += addUnmatchedPatterns(matcher, filesNotFound);
+			if (filesNotFoundCount > 0)
+				exitNotFound(filesNotFound);
+		} else if (isSelecting) {
 			for (int i = 0; i < numFileNamesArgs; i++) {
 				char *fileName = fileNamesArgs[i];
-				if (findFile(fileName, list) == 1) {
-					file_t *newFile = createFile(fileName);
-					filesFound = addFile(filesFound, newFile);
+				member_t *member = NULL;
+				bool isFound = (index != NULL)
+							? findIndexEntry(index, fileName) != NULL
+							: (member = findMember(members, fileName)) != NULL;
+				if (isFound) {
+					addMember(filesFound, fileName,
+						(member != NULL) ? member->header : NULL);
 					filesFoundCount++;
 				} else {
-					file_t *newFile = createFile(fileName);
-					filesNotFound = addFile(filesNotFound, newFile);
+					addMember(filesNotFound, fileName, NULL);
 					filesNotFoundCount++;
 				}
 			}
 
 			if (filesFoundCount > 0) {
-				file_t **ptrFilesFound = &filesFound;
-				sortFileList(ptrFilesFound);
-				printNameFiles(filesFound, filesNotFoundCount);
+				sortFileList(filesFound);
+				printNameFiles(filesFound, filesNotFoundCount, listFormat);
 			}
 
-			if (filesNotFoundCount > 0) {
-				file_t *current = filesNotFound;
-				while (current != NULL) {
-					fprintf(stderr, MSG_PREFFIX " %s: Not found in"
-							" archive\n", current->name);
-					current = current->next;
-				}
-				fprintf(stderr, MSG_PREFFIX " Exiting with failure status due"
-						" to previous errors\n");
-				exit(ERROR_CODE_TWO);
-			}
+			if (filesNotFoundCount > 0)
+				exitNotFound(filesNotFound);
 		}
 
 		if (isLoneZeroBlock == true)
 			printf(MSG_PREFFIX " A lone zero block at %d\n",
 					posZeroBlock);
+		if (tarArchive != NULL) {
+			if (tarArchive->numSkippedHeaders > 0)
+				isHeaderSkipped = true;
+			closeArchive(tarArchive);
+		}
+		if (index != NULL)
+			closeIndex(index);
 	}
 
 	if (x) {
-		if (numFileNamesArgs == 0) {
-			tarArchive = fopen(tarArchiveName, "r");
+		if (!isSelecting) {
+			tarArchive = openArchive(tarArchiveName, compression, ioPolicy);
 			if (tarArchive == NULL) {
 				printf(MSG_PREFFIX " %s file does not exist in current"
-						" directory\n", argv[2]);
+						" directory\n", missingName);
 				exit(ERROR_CODE_TWO);
 			}
 
-			header_t *list = NULL;
+			extractPool_t *pool = NULL;
+			if (queueDepth > 0 && tarArchive->reader == READER_MMAP)
+				pool = createUringPool(tarArchive, queueDepth);
+			if (pool == NULL && numJobs > 1 &&
+				tarArchive->reader == READER_MMAP)
+				pool = createExtractPool(tarArchive, numJobs);
+			dirCache_t *dirs = createDirCache(arena);
+
 			int posZeroBlock = 1;
 			bool isLoneZeroBlock = false;
 
-			while (1) {
-				header_t *newHeader = createHeader();
-				size_t element_read = fread((newHeader->block),
-									sizeof (newHeader->block), 1, tarArchive);
-				if (ferror(tarArchive)) {
-					free(newHeader);
-					exit(EXIT_FAILURE);
-				}
-
-				if (element_read != 1)
-					break;
-
-				if (isZeroBlock(newHeader) == true) {
-					if (fread((newHeader->block),
-						sizeof (newHeader->block), 1, tarArchive) != 1) {
-						posZeroBlock ++;
-						isLoneZeroBlock = true;
-					}
-					if (ferror(tarArchive))
-						exit(EXIT_FAILURE);
-					break;
-				}
-
-				if ((newHeader->typeflag != REGTYPE) &&
-					newHeader->typeflag != AREGTYPE) {
-					printf(MSG_PREFFIX " Unsupported header type:"
-							" %d\n", newHeader->typeflag);
-					exit(ERROR_CODE_TWO);
-				}
-
-				if (isTarFile(newHeader->magic) == false) {
-					printf(MSG_PREFFIX " This does not look like a tar"
-							" archive\n");
-					printf(MSG_PREFFIX " Exiting with failure status due to"
-							" previous errors\n");
-					exit(ERROR_CODE_TWO);
-				}
-
-				list = addHeader(list, newHeader);
-
-				size_t bytesToRead = countBytesToSkip(newHeader);
-				if (bytesToRead == 0)
-					extractEmptyFile(newHeader->name);
-				else {
-					FILE *newFile = fopen(newHeader->name, "w");
-					if (newFile == NULL) {
-						printf("Error creating the file: %s\n", newHeader->name);
-					} else {
-						while (bytesToRead > 0) {
-							char *buffer = xmalloc(BLOCKSIZE_BYTES);
-							size_t bytesRead = fread(buffer, sizeof (char), BLOCKSIZE_BYTES,
-												tarArchive);
-							if (ferror(tarArchive)) {
-								free(buffer);
-								exit(EXIT_FAILURE);
-							}
-
-							if (bytesRead == 0) {
-								isFileTruncated = true;
-								file_t *fileTruncated= createFile(newHeader->name);
-								listFilesTruncated = addFile(listFilesTruncated, fileTruncated);
-								break;
-							}
-
-							size_t elementsWritten = fwrite(buffer, sizeof (char),
-													BLOCKSIZE_BYTES, newFile);
-							if (elementsWritten == 0) {
-								if (ferror(newFile)) {
-									fclose(newFile);
-									exit(EXIT_FAILURE);
-								}
-							}
-							free(buffer);
-							bytesToRead -= bytesRead;
-							posZeroBlock++;
-						}
-						fclose(newFile);
-					}
-				}
+			iterator_t iterator;
+			initIterator(&iterator, tarArchive);
+			int status;
+			while ((status = nextMember(&iterator)) == TAR_OK) {
+				char *memberName = iterator.name;
+				posZeroBlock += tarArchive->numHeaderBlocks - 1;
+				if (matcher->numExcludes > 0 &&
+					(matchName(matcher, memberName) & MATCH_EXCLUDE))
+					continue;
+				if (pool != NULL &&
+					findMember(listFilesExtracted, memberName) != NULL)
+					waitExtractPool(pool);
+				int extracted = extractFile(&iterator, memberName,
+									&posZeroBlock, pool, dirs, skipUnchanged);
+				if (extracted == EXTRACT_TRUNCATED) {
+					isFileTruncated = true;
+					addMember(listFilesTruncated, memberName, NULL);
+				} else if (extracted == EXTRACT_UNCHANGED)
+					numUnchanged++;
 
-				file_t *fileExtracted = createFile(newHeader->name);
-				listFilesExtracted = addFile(listFilesExtracted, fileExtracted);
+				addMember(listFilesExtracted, memberName, NULL);
+			}
+			if (status != TAR_END) {
+				/* extraction reports the type of a block first */
+				if (status == TAR_ERR_NOT_TAR &&
+					!isSupportedMember(iterator.header))
+					status = TAR_ERR_UNSUPPORTED;
+				if (pool != NULL)
+					finishExtractPool(pool);
+				exitArchiveError(&iterator, status);
+			}
+			if (iterator.isLoneZeroBlock) {
+				posZeroBlock++;
+				isLoneZeroBlock = true;
 			}
-			fclose(tarArchive);
+			if (pool != NULL)
+				finishExtractPool(pool);
+			freeDirCache(dirs);
+			if (tarArchive->numSkippedHeaders > 0)
+				isHeaderSkipped = true;
+			closeArchive(tarArchive);
 
 			if (isFileTruncated == true) {
 				if (v)
@@ -650,6 +6780,9 @@ int main(int argc, char *argv[]) {
 				printf(MSG_PREFFIX " Error is not recoverable: exiting now\n");
 				exit(ERROR_CODE_TWO);
 			}
+			if (skipUnchanged != UNCHANGED_OFF)
+				printf(MSG_PREFFIX " %d unchanged files skipped\n",
+						numUnchanged);
 
 			if (v) {
 				printNameFilesExtracted(listFilesExtracted);
@@ -662,107 +6795,117 @@ int main(int argc, char *argv[]) {
 							posZeroBlock);
 			}
 		} else {
-			tarArchive = fopen(tarArchiveName, "r");
+			tarArchive = openArchive(tarArchiveName, compression, ioPolicy);
 			if (tarArchive == NULL) {
 				printf(MSG_PREFFIX " %s file does not exist in current"
-						" directory\n", argv[2]);
+						" directory\n", missingName);
 				exit(ERROR_CODE_TWO);
 			}
 
+			extractPool_t *pool = NULL;
+			if (queueDepth > 0 && tarArchive->reader == READER_MMAP)
+				pool = createUringPool(tarArchive, queueDepth);
+			if (pool == NULL && numJobs > 1 &&
+				tarArchive->reader == READER_MMAP)
+				pool = createExtractPool(tarArchive, numJobs);
+			dirCache_t *dirs = createDirCache(arena);
+
 			int posZeroBlock = 1;
 			bool isLoneZeroBlock = false;
 
-			while (1) {
-				header_t *newHeader = createHeader();
-				size_t element_read = fread((newHeader->block),
-									sizeof (newHeader->block), 1, tarArchive);
-				if (ferror(tarArchive)) {
-					free(newHeader);
-					exit(EXIT_FAILURE);
-				}
-
-				if (element_read != 1)
-					break;
+			iterator_t iterator;
+			initIterator(&iterator, tarArchive);
+			int status;
 
-				if (isZeroBlock(newHeader) == true) {
-					if (fread((newHeader->block),
-						sizeof (newHeader->block), 1, tarArchive) != 1) {
-						posZeroBlock ++;
-						isLoneZeroBlock = true;
-					}
-					if (ferror(tarArchive))
-						exit(EXIT_FAILURE);
-					break;
+			index_t *index = NULL;
+			if (matcher->numPatterns == 0)
+				index = openIndex(tarArchiveName);
+			if (index != NULL) {
+				indexEntry_t **selected = xmalloc(numFileNamesArgs
+											* sizeof (indexEntry_t *));
+				int numSelected = 0;
+				for (int i = 0; i < numFileNamesArgs; i++) {
+					indexEntry_t *entry = findIndexEntry(index, fileNamesArgs[i]);
+					if (entry != NULL)
+						selected[numSelected++] = entry;
 				}
+				qsort(selected, numSelected, sizeof (indexEntry_t *),
+					compareIndexEntries);
 
-				if ((newHeader->typeflag != REGTYPE) &&
-					newHeader->typeflag != AREGTYPE) {
-					printf(MSG_PREFFIX " Unsupported header type:"
-							" %d\n", newHeader->typeflag);
-					exit(ERROR_CODE_TWO);
+				for (int i = 0; i < numSelected; i++) {
+					indexEntry_t *entry = selected[i];
+					if (i > 0 && entry == selected[i - 1])
+						continue;
+					seekMember(&iterator, entry->offset);
+					status = nextMember(&iterator);
+					if (status == TAR_END)
+						status = TAR_ERR_TRUNCATED;
+					if (status != TAR_OK) {
+						if (pool != NULL)
+							finishExtractPool(pool);
+						exitArchiveError(&iterator, status);
+					}
+					char *name = indexEntryName(index, entry);
+					int extracted = extractFile(&iterator, name,
+										&posZeroBlock, pool, dirs,
+										skipUnchanged);
+					if (extracted == EXTRACT_TRUNCATED) {
+						isFileTruncated = true;
+						addMember(listFilesTruncated, name, NULL);
+					} else if (extracted == EXTRACT_UNCHANGED)
+						numUnchanged++;
+					addMember(listFilesExtracted, name, NULL);
 				}
 
-				if (isTarFile(newHeader->magic) == false) {
-					printf(MSG_PREFFIX " This does not look like a tar"
-							" archive\n");
-					printf(MSG_PREFFIX " Exiting with failure status due to"
-							" previous errors\n");
-					exit(ERROR_CODE_TWO);
+				if (index->header->isLoneZeroBlock) {
+					posZeroBlock++;
+					isLoneZeroBlock = true;
 				}
+				free(selected);
+				closeIndex(index);
+			} else {
+				memberTable_t *filesRequested = createMemberTable(arena);
+				for (int i = 0; i < numFileNamesArgs; i++)
+					addMember(filesRequested, fileNamesArgs[i], NULL);
 
-				size_t bytesToRead = countBytesToSkip(newHeader);
+				while ((status = nextMember(&iterator)) == TAR_OK) {
+					char *memberName = iterator.name;
+					posZeroBlock += tarArchive->numHeaderBlocks - 1;
 
-				for (int i = 0; i < numFileNamesArgs; i++) {
-					char *fileName = fileNamesArgs[i];
-					if (strcmp(fileName, newHeader->name) == 0 
-						&& findFileExtracted(fileName, listFilesExtracted) == 0) {
-						if (bytesToRead == 0)
-							extractEmptyFile(newHeader->name);
-						else {
-							FILE *newFile = fopen(newHeader->name, "w");
-							if (newFile == NULL) {
-								printf("Error creating the file: %s\n", newHeader->name);
-							} else {
-								char *buffer = xmalloc(BLOCKSIZE_BYTES);
-								while (bytesToRead > 0) {
-									size_t bytesRead = fread(buffer, sizeof (char), BLOCKSIZE_BYTES,
-														tarArchive);
-									if (ferror(tarArchive)) {
-										free(buffer);
-										exit(EXIT_FAILURE);
-									}
-
-									if (bytesRead == 0) {
-										isFileTruncated = true;
-										file_t *fileTruncated= createFile(newHeader->name);
-										listFilesTruncated = addFile(listFilesTruncated, fileTruncated);
-										break;
-									}
-
-									size_t elementsWritten = fwrite(buffer, sizeof (char),
-															BLOCKSIZE_BYTES, newFile);
-									if (elementsWritten == 0) {
-										if (ferror(newFile)) {
-											fclose(newFile);
-											exit(EXIT_FAILURE);
-										}
-									}
-									bytesToRead -= bytesRead;
-									posZeroBlock++;
-								}
-								free(buffer);
-								fclose(newFile);
-							}
-						}
-						file_t *fileExtracted = createFile(newHeader->name);
-						listFilesExtracted = addFile(listFilesExtracted, fileExtracted);
-					}
+					if (isSelectedMember(filesRequested, matcher, memberName)
+						&& findMember(listFilesExtracted, memberName) == NULL) {
+						int extracted = extractFile(&iterator, memberName,
+											&posZeroBlock, pool, dirs,
+											skipUnchanged);
+						if (extracted == EXTRACT_TRUNCATED) {
+							isFileTruncated = true;
+							addMember(listFilesTruncated, memberName, NULL);
+						} else if (extracted == EXTRACT_UNCHANGED)
+							numUnchanged++;
+						addMember(listFilesExtracted, memberName, NULL);
+					} else
+						skipMember(&iterator);
 				}
-
-				if (findFileExtracted(newHeader->name, listFilesExtracted) == 0)
-					fseek(tarArchive, bytesToRead, SEEK_CUR);
+				if (status != TAR_END) {
+					if (status == TAR_ERR_NOT_TAR &&
+						!isSupportedMember(iterator.header))
+						status = TAR_ERR_UNSUPPORTED;
+					if (pool != NULL)
+						finishExtractPool(pool);
+					exitArchiveError(&iterator, status);
+				}
+				if (iterator.isLoneZeroBlock) {
+					posZeroBlock++;
+					isLoneZeroBlock = true;
+				}
+				freeMemberTable(filesRequested);
 			}
-			fclose(tarArchive);
+			if (pool != NULL)
+				finishExtractPool(pool);
+			freeDirCache(dirs);
+			if (tarArchive->numSkippedHeaders > 0)
+				isHeaderSkipped = true;
+			closeArchive(tarArchive);
 
 			if (isFileTruncated == true) {
 				if (v)
@@ -771,41 +6914,35 @@ int main(int argc, char *argv[]) {
 				printf(MSG_PREFFIX " Error is not recoverable: exiting now\n");
 				exit(ERROR_CODE_TWO);
 			}
+			if (skipUnchanged != UNCHANGED_OFF)
+				printf(MSG_PREFFIX " %d unchanged files skipped\n",
+						numUnchanged);
 
 			if (isLoneZeroBlock == true)
 				printf(MSG_PREFFIX " A lone zero block at %d\n",
 						posZeroBlock);
 
 			for (int i = 0; i < numFileNamesArgs; i++) {
-				if (findFileExtracted(fileNamesArgs[i], listFilesExtracted) == 1) {
-					file_t *fileFound = createFile(fileNamesArgs[i]);
-					filesFound = addFile(filesFound, fileFound);
+				if (findMember(listFilesExtracted, fileNamesArgs[i]) != NULL) {
+					addMember(filesFound, fileNamesArgs[i], NULL);
 					filesFoundCount++;
 				} else {
-					file_t *fileNotFound = createFile(fileNamesArgs[i]);
-					filesNotFound = addFile(filesNotFound, fileNotFound);
+					addMember(filesNotFound, fileNamesArgs[i], NULL);
 					filesNotFoundCount++;
 				}
 			}
+			filesNotFoundCount += addUnmatchedPatterns(matcher, filesNotFound);
 
 			if (v) {
-				if (filesFoundCount > 0) {
-					file_t **ptrFilesFound = &filesFound;
-					sortFileList(ptrFilesFound);
+				if (matcher->numIncludes > 0)
+					printNameFilesExtracted(listFilesExtracted);
+				else if (filesFoundCount > 0) {
+					sortFileList(filesFound);
 					printNameFilesExtracted(filesFound);
 				}
 
-				if (filesNotFoundCount > 0) {
-					file_t *current = filesNotFound;
-					while (current != NULL) {
-						fprintf(stderr, MSG_PREFFIX " %s: Not found in"
-								" archive\n", current->name);
-						current = current->next;
-					}
-					fprintf(stderr, MSG_PREFFIX " Exiting with failure status due to"
-							" previous errors\n");
-					exit(ERROR_CODE_TWO);
-				}
+				if (filesNotFoundCount > 0)
+					exitNotFound(filesNotFound);
 
 				if (isLoneZeroBlock == true)
 					printf(MSG_PREFFIX " A lone zero block at %d\n",
@@ -813,11 +6950,29 @@ int main(int argc, char *argv[]) {
 			}
 		}
 	}
-	freeList(list, 1);
-	freeList(filesFound, 2);
-	freeList(filesNotFound, 2);
-	freeList(listFilesExtracted, 2);
-	freeList(listFilesTruncated, 2);
+	freeMemberTable(members);
+	freeMemberTable(filesFound);
+	freeMemberTable(filesNotFound);
+	freeMemberTable(listFilesExtracted);
+	freeMemberTable(listFilesTruncated);
+	freeMatcher(matcher);
+	if (stats) {
+		mergeThreadStats();
+		printStats(&totals, nowNanos() - startNanos);
+		printArenaStats(arena);
+	}
+	releaseArena(arena);
+	free(arena);
 	free(fileNamesArgs);
+	free(archiveNames);
+	for (int i = 0; i < numNameLists; i++)
+		free(nameLists[i]);
+	free(nameLists);
+	if (isHeaderSkipped) {
+		fprintf(stderr, MSG_PREFFIX " Exiting with failure status due to"
+				" previous errors\n");
+		return (ERROR_CODE_TWO);
+	}
 	return (0);
 }
+#endif
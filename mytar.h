@@ -0,0 +1,202 @@
+/*
+ * Archive reading interface of mytar, for programs embedding its parser.
+ * libmytar.a is mytar.c built with -DMYTAR_LIBRARY, without main(), and
+ * exports the functions declared here only.
+ *
+ * openArchive() opens an archive and an iterator_t walks its members:
+ * nextMember() moves to the next member, whose data is then read with
+ * readMemberData(), written to a file with writeMemberData(), or skipped
+ * by the next nextMember(). None of them exits on a bad or unreadable
+ * archive; they return TAR_OK or a TAR_ code. Only running out of memory
+ * or failing to start a decompression thread ends the process.
+ *
+ * An archive is used by one thread at a time; separate archives can be
+ * read in parallel. Nothing is printed, except for a warning on stderr
+ * for each corrupt header skipped, as GNU tar does.
+ */
+
+#ifndef MYTAR_H
+#define	MYTAR_H
+
+/*
+ * INCLUDES
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * MACROS
+ */
+
+/* Block size of blocks of an archive */
+#define	BLOCKSIZE_BYTES				512
+
+/* Maximun size of file name */
+#define	SIZE_NAME_MAX				100
+
+/* Size of the prefix field of a ustar header */
+#define	SIZE_PREFIX_MAX				155
+
+/* Values for typeflag field */
+/* Regular file */
+#define	REGTYPE						'0'
+/* Regular file */
+#define	AREGTYPE					'\0'
+/* Link */
+#define	LNKTYPE						'1'
+/* Reserved */
+#define	SYMTYPE						'2'
+/* Character special */
+#define	CHRTYPE						'3'
+/* Block special */
+#define	BLKTYPE						'4'
+/* Directory */
+#define	DIRTYPE						'5'
+/* FIFO special */
+#define	FIFOTYPE					'6'
+/* Reserved */
+#define	CONTTYPE					'7'
+/* Extended header referring to the next file in the archive */
+#define	XHDTYPE						'x'
+/* Global extended header */
+#define	XGLTYPE						'g'
+/* GNU sparse file */
+#define	GNUTYPE_SPARSE				'S'
+
+/* Sparse map entries of an old GNU header and of its extension blocks,
+ * an offset and a size of 12 bytes each */
+#define	SPARSE_HEADER_ENTRIES		4
+#define	SPARSE_EXTENSION_ENTRIES	21
+#define	SPARSE_ENTRY_BYTES			24
+
+/* Compression of an archive; COMPRESS_AUTO detects it by magic */
+#define	COMPRESS_AUTO				0
+#define	COMPRESS_NONE				1
+#define	COMPRESS_GZIP				2
+#define	COMPRESS_ZSTD				3
+
+/* Page cache policies of an archive: the default, hints that keep the
+ * archive and the extracted files from filling the cache, and those
+ * hints plus O_DIRECT writes of large members */
+#define	IO_CACHE					0
+#define	IO_NOCACHE					1
+#define	IO_DIRECT					2
+
+/* Results of the member iterator; errors are negative. TAR_ERR_CORRUPT
+ * is compressed data that does not decompress, TAR_ERR_COMPRESSION a
+ * compression the library was built without */
+#define	TAR_OK						0
+#define	TAR_END						1
+#define	TAR_ERR_NOT_TAR				(-1)
+#define	TAR_ERR_UNSUPPORTED			(-2)
+#define	TAR_ERR_TRUNCATED			(-3)
+#define	TAR_ERR_SPARSE_MAP			(-4)
+#define	TAR_ERR_IO					(-5)
+#define	TAR_ERR_CORRUPT				(-6)
+#define	TAR_ERR_COMPRESSION			(-7)
+
+/*
+ * TYPES
+ */
+
+typedef struct header {
+    union {
+		struct {
+			char name[100];
+			char mode[8];
+			char uid[8];
+			char gid[8];
+			char size[12];
+			char mtime[12];
+			char chksum[8];
+			char typeflag;
+			char linkname[100];
+			char magic[6];
+			char version[2];
+			char uname[32];
+			char gname[32];
+			char devmajor[8];
+			char devminor[8];
+			char prefix[SIZE_PREFIX_MAX];
+		};
+		/* old GNU layout, which keeps the fields up to devminor */
+		struct {
+			char ustarFields[345];
+			char atime[12];
+			char ctime[12];
+			char offset[12];
+			char longnames[4];
+			char unused;
+			char sparse[SPARSE_HEADER_ENTRIES * SPARSE_ENTRY_BYTES];
+			char isExtended;
+			char realSize[12];
+		};
+		char block[BLOCKSIZE_BYTES];
+	};
+} header_t;
+
+/*
+ * Data regions of a sparse file, pairs of an offset and a size in
+ * regions, stored one after the other as the member data, and the size
+ * of the whole file.
+ */
+typedef struct sparseMap {
+	uint64_t *regions;
+	size_t numRegions;
+	size_t capacity;
+	uint64_t realSize;
+} sparseMap_t;
+
+/*
+ * An opened archive, only handled through the functions below.
+ */
+typedef struct archive archive_t;
+
+/*
+ * Iterator over the members of an archive. name, size and sparse are
+ * those of the current member, after its pax extended header and sparse
+ * map; header is its last header. contentLeft and dataLeft are the
+ * bytes of member data left in the archive, without and with the
+ * padding. hasEndMarker is set when the archive ends in zero blocks and
+ * isLoneZeroBlock when it ends in a single one.
+ */
+typedef struct iterator {
+	archive_t *archive;
+	header_t *header;
+	char *name;
+	size_t size;
+	sparseMap_t *sparse;
+	size_t contentLeft;
+	size_t dataLeft;
+	bool hasEndMarker;
+	bool isLoneZeroBlock;
+} iterator_t;
+
+/*
+ * FUNCTIONS PROTOTYPES
+ */
+
+/* opens fileName, or the standard input for NULL or "-"; NULL if the
+ * file cannot be opened */
+archive_t *openArchive(char *fileName, int compression, int ioPolicy);
+void closeArchive(archive_t *archive);
+
+void initIterator(iterator_t *iterator, archive_t *archive);
+/* TAR_OK, TAR_END after the last member, or an error */
+int nextMember(iterator_t *iterator);
+/* bytes read, 0 after the last ones, or an error */
+ssize_t readMemberData(iterator_t *iterator, char *buffer, size_t len);
+int writeMemberData(iterator_t *iterator, int fd);
+int skipMember(iterator_t *iterator);
+/* moves to the member whose headers start at offset; streams only
+ * move forward */
+void seekMember(iterator_t *iterator, size_t offset);
+
+/* value of a numeric header field, octal or base-256; 0 if negative and
+ * UINT64_MAX if above 2^63 - 1 */
+uint64_t parseNumeric(char *field, size_t len);
+
+#endif
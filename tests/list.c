@@ -0,0 +1,61 @@
+/*
+ * INCLUDES
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "mytar.h"
+
+/*
+ * FUNCTIONS
+ */
+
+/*
+ * lists the members of an archive through libmytar, reading the data of
+ * each one, the way -t lists them:
+ *
+ *   list ARCHIVE
+ *
+ * Exits with 0 at the end of the archive, 2 if it cannot be opened, and
+ * 3 with the TAR_ code on stderr if the iterator fails, which it must
+ * report rather than exit.
+ */
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: list ARCHIVE\n");
+		return (2);
+	}
+	archive_t *archive = openArchive(argv[1], COMPRESS_AUTO, IO_CACHE);
+	if (archive == NULL) {
+		perror(argv[1]);
+		return (2);
+	}
+
+	iterator_t iterator;
+	initIterator(&iterator, archive);
+	char buffer[BLOCKSIZE_BYTES];
+	int status;
+	while ((status = nextMember(&iterator)) == TAR_OK) {
+		size_t total = 0;
+		ssize_t len;
+		while ((len = readMemberData(&iterator, buffer, sizeof (buffer))) > 0)
+			total += len;
+		if (len < 0) {
+			status = len;
+			break;
+		}
+		if (total != iterator.size) {
+			fprintf(stderr, "%s: read %zu bytes of %zu\n", iterator.name,
+				total, iterator.size);
+			status = TAR_ERR_IO;
+			break;
+		}
+		printf("%s\n", iterator.name);
+	}
+	closeArchive(archive);
+	if (status != TAR_END) {
+		fprintf(stderr, "error %d\n", status);
+		return (3);
+	}
+	return (0);
+}
@@ -0,0 +1,355 @@
+#!/bin/sh
+#
+# Smoke tests of mytar: generated archives, round trips through GNU tar
+# both ways, sparse members extracted with their holes, lookups through
+# the sidecar index and, given the tests/list program, the library.
+#
+#   tests/smoke.sh [MYTAR [LIST]]
+#
+# Checks needing GNU tar are skipped without it. Exits 1 if any check
+# fails.
+#
+
+MYTAR=${1:-./mytar}
+case $MYTAR in /*) ;; *) MYTAR=$(pwd)/$MYTAR ;; esac
+LIST=$2
+case $LIST in /*|'') ;; *) LIST=$(pwd)/$LIST ;; esac
+TAR=${TAR:-tar}
+work=$(mktemp -d) || exit 2
+trap 'rm -rf "$work"' EXIT
+failures=0
+
+fail() {
+	echo "FAIL: $*"
+	failures=$((failures + 1))
+}
+
+# the 64-bit little-endian word at byte offset $2 of file $1, and
+# overwriting it with $3
+getWord() {
+	od -A n -t u8 -j "$2" -N 8 "$1" | tr -d ' '
+}
+
+putWord() {
+	value=$3 bytes=
+	for i in 1 2 3 4 5 6 7 8; do
+		bytes="$bytes\\$(printf '%03o' $((value % 256)))"
+		value=$((value / 256))
+	done
+	printf "$bytes" | dd of="$1" bs=1 seek="$2" conv=notrunc 2>/dev/null
+}
+
+# runs a command, killed after a minute where timeout(1) is there
+bounded() {
+	if command -v timeout > /dev/null; then
+		timeout 60 "$@"
+	else
+		"$@"
+	fi
+}
+
+hasGnuTar() {
+	"$TAR" --version 2>/dev/null | grep -q 'GNU tar'
+}
+
+# a tree of regular files: empty, tiny, one larger than the size mytar
+# -c reads into memory and one not a multiple of the block size
+makeFiles() {
+	mkdir -p "$1" && (
+		cd "$1" || exit 2
+		: > empty
+		echo hello > tiny
+		head -c 3000000 /dev/urandom > large
+		head -c 1234 /dev/urandom > odd
+	)
+}
+
+cd "$work" || exit 2
+
+# --generate is deterministic and writes what GNU tar reads
+"$MYTAR" --generate 50:0-64K:12 -f g1.tar &&
+	"$MYTAR" --generate 50:0-64K:12 -f g2.tar || fail "--generate"
+cmp -s g1.tar g2.tar || fail "--generate is not deterministic"
+[ "$("$MYTAR" -t -f g1.tar | wc -l)" -eq 50 ] || fail "-t of a generated archive"
+if hasGnuTar; then
+	"$TAR" -t -f g1.tar > gnu.list 2>&1 &&
+		"$MYTAR" -t -f g1.tar | cmp -s - gnu.list ||
+		fail "-t differs from GNU tar on a generated archive"
+fi
+
+# several archives at once, each extracted by its own -j workers, give
+# what extracting them one by one gives
+"$MYTAR" --generate 30:0-8K:3 -f g3.tar || fail "--generate"
+mkdir one-x && (cd one-x && "$MYTAR" -x -f ../g1.tar &&
+	"$MYTAR" -x -f ../g3.tar) || fail "-x of a generated archive"
+mkdir many-x && (cd many-x &&
+	"$MYTAR" -x -j 2 --archive-jobs 2 -f ../g1.tar -f ../g3.tar) ||
+	fail "-x of several archives exits with $?"
+diff -r one-x many-x > /dev/null || fail "-x of several archives"
+
+# many more archives than workers are listed in order, each under its
+# name, while only a few are run ahead of the one being written
+i=1 args= && : > many.list
+while [ $i -le 40 ]; do
+	"$MYTAR" --generate $((i % 7 + 1)):0-4K:$i -f m$i.tar ||
+		fail "--generate"
+	[ $i -gt 1 ] && echo >> many.list
+	echo "m$i.tar:" >> many.list && "$MYTAR" -t -f m$i.tar >> many.list
+	args="$args -f m$i.tar" i=$((i + 1))
+done
+"$MYTAR" -t --archive-jobs 3 $args | cmp -s - many.list ||
+	fail "-t of many archives"
+
+# -j workers and io_uring create members in the directories the scan
+# opened, and report the members of a directory it cannot create
+mkdir -p nest/a/b/c nest/d && for i in 1 2 3 4 5 6 7 8; do
+	echo "$i" > nest/a/b/c/f$i && echo "$i" > nest/d/g$i
+done
+"$MYTAR" -c -f nest.tar nest || fail "-c of a tree exits with $?"
+for mode in "-j 2" "--io-uring"; do
+	rm -rf nest-x && mkdir nest-x &&
+		(cd nest-x && "$MYTAR" -x $mode -f ../nest.tar) &&
+		diff -r nest nest-x/nest > /dev/null || fail "-x $mode of a tree"
+	rm -rf nest-x && mkdir nest-x && : > nest-x/nest &&
+		(cd nest-x && "$MYTAR" -x $mode -f ../nest.tar > ../nest.out)
+	[ "$(grep -c '^Error creating the file: nest/' nest.out)" -eq 16 ] ||
+		fail "-x $mode under a directory that cannot be created"
+done
+
+# round trips: mytar -c read by GNU tar, GNU tar -c read by mytar
+makeFiles src
+if hasGnuTar; then
+	(cd src && "$MYTAR" -c -f ../mine.tar empty tiny large odd) ||
+		fail "-c exits with $?"
+	mkdir gnu-x && (cd gnu-x && "$TAR" -x -f ../mine.tar) &&
+		diff -r src gnu-x > /dev/null ||
+		fail "GNU tar does not extract what mytar -c wrote"
+
+	(cd src && "$TAR" -c -f ../gnu.tar empty tiny large odd)
+	mkdir my-x && (cd my-x && "$MYTAR" -x -f ../gnu.tar) &&
+		diff -r src my-x > /dev/null ||
+		fail "mytar -x differs from the GNU tar input"
+	"$TAR" -t -f gnu.tar > gnu.list
+	"$MYTAR" -t -f gnu.tar | cmp -s - gnu.list ||
+		fail "-t differs from GNU tar"
+fi
+
+# -r and -u write in place over the end of a GNU tar archive, -u only
+# adding files newer than their members
+if hasGnuTar; then
+	mkdir upd && echo one > upd/a && echo two > upd/b &&
+		(cd upd && "$TAR" -c -f ../upd.tar a)
+	(cd upd && "$MYTAR" -r -f ../upd.tar b) || fail "-r exits with $?"
+	printf 'a\nb\n' > upd.list
+	"$TAR" -t -f upd.tar | cmp -s - upd.list ||
+		fail "GNU tar does not list what -r appended"
+	cp upd.tar upd.before
+	(cd upd && "$MYTAR" -u -f ../upd.tar a b) || fail "-u exits with $?"
+	cmp -s upd.tar upd.before || fail "-u of unchanged files changed the archive"
+	echo three > upd/b && touch -d "@$(($(date +%s) + 3600))" upd/b
+	(cd upd && "$MYTAR" -u -f ../upd.tar a b) || fail "-u exits with $?"
+	printf 'a\nb\nb\n' > upd.list
+	"$TAR" -t -f upd.tar | cmp -s - upd.list ||
+		fail "-u of a newer file does not append one member"
+	mkdir upd-x && (cd upd-x && "$TAR" -x -f ../upd.tar) &&
+		[ "$(cat upd-x/b)" = three ] || fail "GNU tar extracts -u wrong"
+fi
+
+# directories and names of 100 characters or more, split into ustar
+# prefix and name or, for a longer last component, given in a PAX path
+if hasGnuTar; then
+	long=$(printf 'd%.0s' $(seq 1 60))
+	mkdir -p tree/sub/void "tree/$long/$long" &&
+		echo deep > "tree/$long/$long/$(printf 'f%.0s' $(seq 1 60))" &&
+		echo single > "tree/sub/$(printf 'n%.0s' $(seq 1 120))" &&
+		makeFiles tree/sub
+	"$MYTAR" -c -f tree.tar tree || fail "-c of a directory exits with $?"
+	mkdir tree-gnu && (cd tree-gnu && "$TAR" -x -f ../tree.tar) &&
+		diff -r tree tree-gnu/tree > /dev/null ||
+		fail "GNU tar does not extract the tree mytar -c wrote"
+	mkdir tree-my && (cd tree-my && "$MYTAR" -x -f ../tree.tar) &&
+		diff -r tree tree-my/tree > /dev/null ||
+		fail "mytar -x does not extract the tree mytar -c wrote"
+	[ -d tree-my/tree/sub/void ] || fail "-c of an empty directory"
+	"$TAR" -t -f tree.tar > tree.list
+	"$MYTAR" -t -f tree.tar | cmp -s - tree.list ||
+		fail "-t of long names differs from GNU tar"
+fi
+
+# members stay in the current directory: leading slashes are removed
+# and names with a ".." component refused, by every extraction path
+if hasGnuTar; then
+	mkdir -p trav/out trav/abs && echo up > trav/up && echo abs > trav/abs/p
+	(cd trav/out && "$TAR" -P -c -f ../../trav.tar ../up "$work/trav/abs/p")
+	rm -rf trav/up trav/abs
+	for mode in "" "-j 2" "--io-uring"; do
+		rm -rf trav/out && mkdir trav/out
+		(cd trav/out && "$MYTAR" -x $mode -f ../../trav.tar > ../x.out)
+		[ ! -e trav/up ] && [ ! -e trav/abs ] &&
+			[ "$(cat "trav/out/${work#/}/trav/abs/p")" = abs ] &&
+			grep -q "Removing leading \`/' from member names" trav/x.out &&
+			grep -q "^mytar: \.\./up: Member name contains '\.\.'" \
+				trav/x.out || fail "-x $mode of .. and absolute names"
+	done
+fi
+
+# sparse members, old GNU and PAX 1.0 maps, come out with their holes
+if hasGnuTar; then
+	mkdir sparse && (
+		cd sparse || exit 2
+		truncate -s 64M disk.img
+		echo middle | dd of=disk.img bs=1 seek=33554432 conv=notrunc \
+			2>/dev/null
+		echo end | dd of=disk.img bs=1 seek=67108000 conv=notrunc \
+			2>/dev/null
+	)
+	for format in gnu posix; do
+		(cd sparse && "$TAR" -S --format=$format -c -f ../sparse.tar \
+			disk.img)
+		rm -rf sparse-x && mkdir sparse-x &&
+			(cd sparse-x && "$MYTAR" -x -f ../sparse.tar) ||
+			fail "-x of a $format sparse member"
+		cmp -s sparse/disk.img sparse-x/disk.img ||
+			fail "$format sparse member extracted wrong"
+		blocks=$(stat -c %b sparse-x/disk.img 2>/dev/null)
+		[ "${blocks:-0}" -gt 0 ] && [ "$blocks" -lt 1024 ] ||
+			fail "$format sparse member extracted without its holes"
+	done
+fi
+
+# with --wildcards, patterns select what GNU tar --wildcards selects,
+# '/' included unless --no-wildcards-match-slash, and --exclude drops
+# members anywhere
+mkdir -p gl/config/deep && touch gl/top.json gl/config/x.json \
+	gl/config/deep/y.json gl/a.so gl/config/b.txt gl/b.so
+"$MYTAR" -c -f gl.tar gl || fail "-c of a tree exits with $?"
+if hasGnuTar; then
+	for args in "*.json" "gl/config/*.json" "gl/**.json" "**/x.json" \
+		"gl/[ac]*" "gl/[!c]*" "gl/?.so" "--exclude=*.json gl/*" \
+		"--exclude deep gl/config*" "--no-wildcards-match-slash gl/*.json"
+	do
+		set -f
+		"$TAR" -t --wildcards -f gl.tar $args 2>&1 | sort > gnu.list
+		"$MYTAR" -t --wildcards -f gl.tar $args 2>&1 | sort |
+			cmp -s - gnu.list ||
+			fail "-t $args differs from GNU tar"
+		set +f
+	done
+fi
+"$MYTAR" -t --wildcards --no-wildcards-match-slash -f gl.tar 'gl/**/y.json' \
+	'gl/*/x.json' 'gl/**/top.json' | sort > gl.list
+printf '%s\n' gl/config/deep/y.json gl/config/x.json gl/top.json |
+	cmp -s - gl.list || fail "-t of ** patterns"
+
+# without --wildcards names are literal, from the command line or -T
+mkdir lit && echo one > 'lit/a[1]' && echo two > 'lit/a1' &&
+	echo star > 'lit/b*' && echo bee > lit/bx
+"$MYTAR" -c -f lit.tar lit || fail "-c of a tree exits with $?"
+"$MYTAR" -t -f lit.tar 'lit/a[1]' 'lit/b*' > lit.list ||
+	fail "-t of names with wildcard characters exits with $?"
+printf '%s\n' 'lit/a[1]' 'lit/b*' | sort | cmp -s - lit.list ||
+	fail "-t of names with wildcard characters"
+printf '%s\n' 'lit/a[1]' 'lit/b*' > lit.names
+rm -rf lit && "$MYTAR" -x -T lit.names -f lit.tar ||
+	fail "-x -T of names with wildcard characters exits with $?"
+[ "$(cat 'lit/a[1]')" = one ] && [ "$(cat 'lit/b*')" = star ] &&
+	[ ! -e lit/a1 ] && [ ! -e lit/bx ] ||
+	fail "-x -T of names with wildcard characters"
+
+# a base-256 size beyond 63 bits is a member running past the archive
+mkdir b256 && echo hi > b256/evil && (cd b256 && "$MYTAR" -c -f ../b256.tar evil)
+printf '\200\377\377\377\377\377\377\377\377\377\377\377' |
+	dd of=b256.tar bs=1 seek=124 conv=notrunc 2>/dev/null
+printf '        ' | dd of=b256.tar bs=1 seek=148 conv=notrunc 2>/dev/null
+sum=$(head -c 512 b256.tar | od -A n -t u1 -v | tr -s ' ' '\n' |
+	awk '{ sum += $1 } END { print sum }')
+printf '%06o\0 ' "$sum" | dd of=b256.tar bs=1 seek=148 conv=notrunc 2>/dev/null
+rm b256/evil
+(cd b256 && "$MYTAR" -x -f ../b256.tar > ../b256.out)
+[ $? -eq 2 ] && [ ! -e b256/evil ] &&
+	grep -q "Unexpected EOF in archive" b256.out ||
+	fail "-x of a member with an overflowing base-256 size"
+
+# a seekable gzip archive whose footer counts more frames than its table
+# holds is read as a plain gzip stream, given gzip support
+if "$MYTAR" -c -z -f seek.tgz g3.tar > /dev/null 2>&1; then
+	size=$(wc -c < seek.tgz)
+	printf '\377\377\377\377' |
+		dd of=seek.tgz bs=1 seek=$((size - 42 + 16)) conv=notrunc 2>/dev/null
+	(ulimit -v 4000000; "$MYTAR" -t -f seek.tgz) | grep -qx g3.tar ||
+		fail "-t of a seekable archive with a bad frame count"
+fi
+
+# lookups through the index give what a scan gives
+"$MYTAR" --generate 1000:0-1K:8 -f indexed.tar || fail "--generate"
+"$MYTAR" -t -f indexed.tar 00000500 00000999 > scan.list
+"$MYTAR" --build-index -f indexed.tar || fail "--build-index"
+[ -f indexed.tar.idx ] || fail "--build-index wrote no index"
+"$MYTAR" -t -f indexed.tar 00000500 00000999 | cmp -s - scan.list ||
+	fail "-t through the index"
+"$MYTAR" -t -f indexed.tar missing > /dev/null 2>&1
+[ $? -eq 2 ] || fail "a missing name looked up through the index"
+mkdir index-x && (cd index-x && "$MYTAR" -x -f ../indexed.tar 00000500) &&
+	[ -f index-x/00000500 ] || fail "-x through the index"
+
+# a malformed index of the right size is ignored: no slots at all, the
+# names made longer to make up for them, then every slot in use
+slots=$((72 + $(getWord indexed.tar.idx 32) * 48))
+numSlots=$(getWord indexed.tar.idx 40)
+putWord indexed.tar.idx 40 0
+putWord indexed.tar.idx 64 $(($(getWord indexed.tar.idx 64) + numSlots * 8))
+bounded "$MYTAR" -t -f indexed.tar 00000500 00000999 | cmp -s - scan.list ||
+	fail "-t through an index without slots"
+"$MYTAR" --build-index -f indexed.tar || fail "--build-index"
+printf '\001\0\0\0\0\0\0\0%.0s' $(seq 1 "$numSlots") |
+	dd of=indexed.tar.idx bs=8 seek=$((slots / 8)) conv=notrunc 2>/dev/null
+bounded "$MYTAR" -t -f indexed.tar 00000500 00000999 | cmp -s - scan.list ||
+	fail "-t through an index with every slot in use"
+bounded "$MYTAR" -t -f indexed.tar missing > /dev/null 2>&1
+[ $? -eq 2 ] || fail "a missing name through an index with every slot in use"
+
+# names longer than a ustar name field are indexed whole
+mkdir -p "longidx/$(printf 'p%.0s' $(seq 1 80))"
+prefixed="longidx/$(printf 'p%.0s' $(seq 1 80))/$(printf 'f%.0s' $(seq 1 70))"
+paxed="longidx/$(printf 'x%.0s' $(seq 1 130))"
+echo prefixed > "$prefixed" && echo paxed > "$paxed"
+"$MYTAR" -c -f longidx.tar longidx && rm -rf longidx ||
+	fail "-c of long names"
+"$MYTAR" --build-index -f longidx.tar || fail "--build-index of long names"
+"$MYTAR" -t -f longidx.tar "$prefixed" "$paxed" > long.list ||
+	fail "-t of long names through the index"
+printf '%s\n%s\n' "$prefixed" "$paxed" | cmp -s - long.list ||
+	fail "-t of long names through the index"
+"$MYTAR" -x -f longidx.tar "$prefixed" "$paxed" &&
+	[ "$(cat "$prefixed")" = prefixed ] && [ "$(cat "$paxed")" = paxed ] ||
+	fail "-x of long names through the index"
+
+# --skip-unchanged never writes through a link at the destination, and
+# skips empty members
+for mode in "" "=contents"; do
+	rm -rf skip && mkdir skip && echo member > skip/linked &&
+		: > skip/empty && "$MYTAR" -c -f skip.tar skip/linked skip/empty
+	echo victim > outside && rm skip/linked && ln -s ../outside skip/linked
+	"$MYTAR" -x --skip-unchanged$mode -f skip.tar ||
+		fail "-x --skip-unchanged$mode exits with $?"
+	[ "$(cat outside)" = victim ] && [ ! -L skip/linked ] &&
+		[ "$(cat skip/linked)" = member ] && [ -f skip/empty ] ||
+		fail "-x --skip-unchanged$mode over a link"
+done
+
+# the library lists what -t lists and returns errors instead of exiting
+if [ -n "$LIST" ]; then
+	"$MYTAR" -t -f g1.tar > g1.list
+	"$LIST" g1.tar | cmp -s - g1.list ||
+		fail "the library lists a generated archive differently"
+	head -c 20000 g1.tar > cut.tar
+	"$LIST" cut.tar > /dev/null 2> lib.err
+	[ $? -eq 3 ] && grep -q "^error -3$" lib.err ||
+		fail "the library on a truncated archive"
+fi
+
+if [ $failures -gt 0 ]; then
+	echo "$failures checks failed"
+	exit 1
+fi
+echo "all checks passed"